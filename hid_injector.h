@@ -0,0 +1,149 @@
+/*
+ * hid_injector.h
+ * Shared between the kernel module and user-space clients (the daemon, test tools).
+ * Keep this header free of kernel-only types so both sides can include it.
+ */
+#ifndef HID_INJECTOR_H
+#define HID_INJECTOR_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define HID_INJECTOR_IOC_MAGIC 'H'
+
+/*
+ * Set the arbitration priority of this open file (int, higher wins).
+ * Writers with equal priority take turns, one whole write() at a time.
+ */
+#define HID_INJECTOR_IOC_SET_PRIORITY _IOW(HID_INJECTOR_IOC_MAGIC, 1, int)
+
+/*
+ * Abort this open file's pending and in-progress writes, or everyone's.
+ * Interrupted writes return -ECANCELED and the host is left with all keys up.
+ * ABORT also sticks: this file's later writes fail with -ECANCELED too, until it
+ * issues HID_INJECTOR_IOC_RESUME. A stop that races a write() that is about to queue is not lost.
+ */
+#define HID_INJECTOR_IOC_ABORT     _IO(HID_INJECTOR_IOC_MAGIC, 2)
+#define HID_INJECTOR_IOC_ABORT_ALL _IO(HID_INJECTOR_IOC_MAGIC, 3)
+#define HID_INJECTOR_IOC_RESUME    _IO(HID_INJECTOR_IOC_MAGIC, 7)
+
+/*
+ * Select what write() takes on this open file (int, HID_INJECTOR_MODE_*).
+ * MODE_ASCII: text, translated by the module (the default).
+ * MODE_KEYS: an array of struct hid_injector_key, typed as-is. Lets a client translate
+ * ahead of time so the write is the only work left when it wants the keys typed.
+ */
+#define HID_INJECTOR_IOC_SET_MODE _IOW(HID_INJECTOR_IOC_MAGIC, 4, int)
+
+#define HID_INJECTOR_MODE_ASCII 0
+#define HID_INJECTOR_MODE_KEYS  1
+
+/*
+ * Progress of this open file's writes, so a client can follow a long write from another thread.
+ * keys_typed only ever grows: sample it before a write and subtract.
+ * first_key_ns is CLOCK_MONOTONIC, comparable with clock_gettime() in user-space.
+ */
+struct hid_injector_progress {
+    __u64 keys_typed;       /* Keys typed for this open file so far */
+    __u64 first_key_ns;     /* When the most recent write had its first key sent */
+};
+
+#define HID_INJECTOR_IOC_GET_PROGRESS _IOR(HID_INJECTOR_IOC_MAGIC, 5, struct hid_injector_progress)
+
+/*
+ * Distribution of the gaps between consecutive key presses within a write, as seen by the host:
+ * measured when each press report completes, i.e. when the host actually read it.
+ * Device-wide, and reading it clears it, so a benchmark reads once before and once after a run.
+ */
+#define HID_INJECTOR_GAP_BUCKETS 64
+
+struct hid_injector_gap_hist {
+    __u32 buckets[HID_INJECTOR_GAP_BUCKETS]; /* buckets[n]: gaps of n to n+1 ms, the last also takes longer ones */
+    __u64 count;
+    __u64 sum_us;
+    __u64 min_us;
+    __u64 max_us;
+};
+
+#define HID_INJECTOR_IOC_GET_GAP_HIST _IOR(HID_INJECTOR_IOC_MAGIC, 6, struct hid_injector_gap_hist)
+
+#define HID_INJECTOR_MOD_LEFT_SHIFT 0x02
+
+/* A single translated keystroke, what one press/release report pair carries */
+struct hid_injector_key {
+    __u8 modifier;
+    __u8 keycode;
+};
+
+/*
+ * Transparency notice: GenAI created function, this is to ensure debugging goes smoothly.
+ * and to prevent my own mistakes from creating any misdebugged things.
+ * Translates an ASCII character to a USB HID keycode and determines
+ * if the Shift modifier is needed.
+ * Lives here so the daemon can translate payloads itself, see HID_INJECTOR_MODE_KEYS.
+ *
+ * @c: The character to translate.
+ * @modifier: A pointer to a __u8 that will be set to HID_INJECTOR_MOD_LEFT_SHIFT if needed.
+ *
+ * Returns: The HID keycode, or 0 for an unsupported character.
+ */
+static inline __u8 hid_injector_char_to_keycode(const char c, __u8 *modifier)
+{
+    *modifier = 0; // Default to no modifier
+
+    if (c >= 'a' && c <= 'z') {
+        return 0x04 + (c - 'a');
+    }
+    if (c >= 'A' && c <= 'Z') {
+        *modifier = HID_INJECTOR_MOD_LEFT_SHIFT;
+        return 0x04 + (c - 'A');
+    }
+    if (c >= '1' && c <= '9') {
+        return 0x1E + (c - '1');
+    }
+
+    switch (c) {
+        case '0': return 0x27;
+        case '\n': return 0x28; /* Enter */
+        case '\t': return 0x2B; /* Tab */
+        case ' ': return 0x2C;  /* Spacebar */
+        case '-': return 0x2D;
+        case '=': return 0x2E;
+        case '[': return 0x2F;
+        case ']': return 0x30;
+        case '\\': return 0x31;
+        case ';': return 0x33;
+        case '\'': return 0x34;
+        case '`': return 0x35;
+        case ',': return 0x36;
+        case '.': return 0x37;
+        case '/': return 0x38;
+
+        /* Characters requiring Shift */
+        case '!': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x1E; /* 1 */
+        case '@': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x1F; /* 2 */
+        case '#': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x20; /* 3 */
+        case '$': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x21; /* 4 */
+        case '%': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x22; /* 5 */
+        case '^': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x23; /* 6 */
+        case '&': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x24; /* 7 */
+        case '*': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x25; /* 8 */
+        case '(': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x26; /* 9 */
+        case ')': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x27; /* 0 */
+        case '_': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x2D; /* - */
+        case '+': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x2E; /* = */
+        case '{': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x2F; /* [ */
+        case '}': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x30; /* ] */
+        case '|': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x31; /* \ */
+        case ':': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x33; /* ; */
+        case '"': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x34; /* ' */
+        case '~': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x35; /* ` */
+        case '<': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x36; /* , */
+        case '>': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x37; /* . */
+        case '?': *modifier = HID_INJECTOR_MOD_LEFT_SHIFT; return 0x38; /* / */
+
+        default: return 0; /* Unsupported character */
+    }
+}
+
+#endif /* HID_INJECTOR_H */
@@ -7,6 +7,7 @@
 #include <linux/fs.h>
 #include <linux/device.h>
 #include <linux/slab.h>
+#include <linux/mm.h> // For kvmalloc_array
 #include <linux/uaccess.h>
 #include <linux/usb/gadget.h>
 #include <linux/hid.h>
@@ -14,11 +15,35 @@
 #include <linux/workqueue.h>
 #include <linux/jiffies.h> // For msecs_to_jiffies
 #include <linux/string.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/math64.h> // For div_u64, plain u64 division doesn't link on 32-bit
+#include <linux/kref.h>
+#include <linux/mutex.h>
+
+#include "hid_injector.h"
 
 #define DRIVER_NAME "hid_injector_gadget"
 #define DEVICE_NAME "hid_injector"
 #define CLASS_NAME  "hid_injector_class"
-#define MOD_LEFT_SHIFT 0x02  /* Add this line */
+#define KEY_HOLD_MS 20       /* How long a key is held down before release */
+#define EP_ENABLE_MAX_TRIES 50 /* Endpoint enable retries, one jiffy apart */
+#define REPORT_REQ_COUNT 4   /* Preallocated IN requests, a key needs two */
+
+/* Writes made before the host configures us are buffered, these bound that buffer. */
+static unsigned int max_pending_keys = 65536;
+module_param(max_pending_keys, uint, 0644);
+MODULE_PARM_DESC(max_pending_keys, "Maximum keystrokes queued across all writers");
+
+static unsigned int unconfigured_timeout_ms = 30000;
+module_param(unconfigured_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(unconfigured_timeout_ms, "How long a write waits for the host to configure the device");
+
+static bool remote_wakeup;
+module_param(remote_wakeup, bool, 0644);
+MODULE_PARM_DESC(remote_wakeup, "Advertise remote wakeup and wake a suspended host when keys are pending");
 
 
 MODULE_LICENSE("GPL");
@@ -26,27 +51,95 @@ MODULE_AUTHOR("Lucas");
 MODULE_DESCRIPTION("A self-contained USB HID keystroke injector (legacy gadget API).");
 MODULE_VERSION("7.3-stable");
 
+/*
+ * One write() worth of keystrokes.
+ * The scheduler types a job from start to finish before picking the next one,
+ * so a payload from one writer is never interleaved with another writer's.
+ * Owned (allocated and freed) by the writer, the scheduler only borrows it.
+ */
+struct hid_injector_job {
+    struct list_head node;          /* On the owning client's job list, empty while being typed */
+    struct hid_injector_client *client;
+    struct hid_injector_key *keys;
+    size_t nkeys;
+    size_t pos;                     /* Keys typed so far */
+    int status;                     /* 0, or the error that stopped the job */
+    bool done;
+};
+
+/* Per-open state, every opener gets its own submission queue */
+struct hid_injector_client {
+    struct hid_injector_dev *dev;
+    struct list_head node;          /* On dev->clients, order is the round-robin order */
+    struct list_head jobs;          /* Pending jobs, FIFO */
+    int priority;                   /* Higher is served first, see HID_INJECTOR_IOC_SET_PRIORITY */
+    int mode;                       /* HID_INJECTOR_MODE_*, what write() expects */
+    bool aborted;                   /* Under queue_lock: HID_INJECTOR_IOC_ABORT until HID_INJECTOR_IOC_RESUME */
+    atomic64_t keys_typed;          /* Only the scheduler writes these two, see HID_INJECTOR_IOC_GET_PROGRESS */
+    atomic64_t first_key_ns;
+};
+
 /* Main device structure */
 struct hid_injector_dev {
+    struct kref kref;               /* Held by the gadget binding and by every open file */
+    bool dead;                      /* Unbound, under queue_lock: open files only get -ENODEV */
     struct usb_gadget *gadget;
     struct usb_request *req0;       /* For control endpoint requests */
     struct usb_ep *in_ep;           /* Interrupt IN endpoint */
     int major;                      /* Character device major number */
     struct class *dev_class;        /* Device class */
     bool interface_active;
+    bool suspended;                 /* Host suspended the bus, the scheduler holds off until resume */
+    bool wakeup_requested;          /* Remote wakeup already signalled for this suspend */
+    atomic_t report_failed;         /* A report completed with an error, e.g. flushed on suspend */
     struct delayed_work set_config_work; /* Use delayed work for UDC race */
     char *user_space_msg;           /* Buffer for message from user-space */
+
+    /* Writer arbitration, queue_lock protects clients and every client's job list */
+    spinlock_t queue_lock;
+    struct list_head clients;
+    struct work_struct inject_work; /* The one scheduler that owns the IN endpoint */
+    struct workqueue_struct *inject_wq; /* High priority, so other kworkers can't stretch the key timing */
+    wait_queue_head_t job_wait;     /* Writers sleep here until their job is done */
+    size_t pending_keys;            /* Keys queued or being typed, bounded by max_pending_keys */
+    struct hid_injector_job *active_job; /* Job the scheduler is typing, NULL between jobs */
+    bool abort_active;              /* Stop active_job at the next pacing point */
+    wait_queue_head_t pace_wait;    /* Scheduler sleeps here between reports, aborts wake it */
+
+    /*
+     * IN requests are allocated once and reused. Because they stay valid after completion,
+     * an abort can safely usb_ep_dequeue() whatever the host has not picked up yet.
+     */
+    struct usb_ep *report_ep;       /* Endpoint the requests were allocated for */
+    struct usb_request *report_reqs[REPORT_REQ_COUNT];
+    unsigned long report_busy;      /* Bit n set while report_reqs[n] is queued */
+
+    /* Key timing as the host saw it, under queue_lock, see HID_INJECTOR_IOC_GET_GAP_HIST */
+    ktime_t last_press_ts;          /* Last press report completed in this job, 0 at a job start */
+    struct hid_injector_gap_hist gaps;
+
+    /* Fast ready-on-configure */
+    int ep_enable_tries;
+    ktime_t connect_ts;             /* First control request since bind/disconnect */
+    ktime_t config_ts;              /* SET_CONFIGURATION received */
+    ktime_t ready_ts;               /* IN endpoint enabled */
+    bool first_key_sent;
+    s64 enum_us;                    /* connect -> SET_CONFIGURATION, host driven */
+    s64 enable_us;                  /* SET_CONFIGURATION -> endpoint enabled, ours */
+    s64 first_key_us;               /* endpoint enabled -> first report queued */
 };
 
 static struct hid_injector_dev *g_hid_dev;
+static DEFINE_MUTEX(g_hid_dev_lock); /* Serializes open() against unbind clearing g_hid_dev */
 
 /* Forward Declarations - just a C thing lol */
 static int dev_open(struct inode *, struct file *);
 static int dev_release(struct inode *, struct file *);
 static ssize_t dev_write(struct file *, const char __user *, size_t, loff_t *);
 static ssize_t dev_read(struct file *, char __user *, size_t, loff_t *);
+static long dev_ioctl(struct file *, unsigned int, unsigned long);
 static void hid_set_config_work_handler(struct work_struct *w);
-static u8 char_to_hid_keycode(const char c, u8 *modifier);
+static void hid_inject_work_handler(struct work_struct *w);
 static void hid_injector_complete(struct usb_ep *ep, struct usb_request *req);
 static int hid_injector_send_report(struct hid_injector_dev *dev, u8 *report);
 
@@ -131,75 +224,406 @@ static const struct file_operations fops = {
     .release = dev_release,
     .write = dev_write,
     .read = dev_read,
+    .unlocked_ioctl = dev_ioctl,
+    /* The ioctl structs are laid out the same for 32-bit user space, e.g. armhf on a 64-bit Pi kernel */
+    .compat_ioctl = compat_ptr_ioctl,
 };
 
+static void hid_injector_dev_free(struct kref *kref)
+{
+    kfree(container_of(kref, struct hid_injector_dev, kref));
+}
+
 static int dev_open(struct inode *inode, struct file *file)
 {
-    file->private_data = g_hid_dev;
+    struct hid_injector_dev *dev;
+    struct hid_injector_client *client;
+    unsigned long flags;
+
+    client = kzalloc(sizeof(*client), GFP_KERNEL);
+    if (!client) {
+        return -ENOMEM;
+    }
+
+    /* The file keeps the device struct alive, even past an unbind */
+    mutex_lock(&g_hid_dev_lock);
+    dev = g_hid_dev;
+    if (dev) {
+        kref_get(&dev->kref);
+    }
+    mutex_unlock(&g_hid_dev_lock);
+    if (!dev) {
+        kfree(client);
+        return -ENODEV;
+    }
+    client->dev = dev;
+    INIT_LIST_HEAD(&client->jobs);
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    list_add_tail(&client->node, &dev->clients);
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+
+    file->private_data = client;
     return 0;
 }
 
 static int dev_release(struct inode *inode, struct file *file)
 {
+    struct hid_injector_client *client = file->private_data;
+    struct hid_injector_dev *dev = client->dev;
+    unsigned long flags;
+
+    /*
+     * No job can be queued here: write() holds a reference to the file
+     * until its job is done, so release only runs once every writer returned.
+     */
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    list_del(&client->node);
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+
+    kfree(client);
+    kref_put(&dev->kref, hid_injector_dev_free);
     file->private_data = NULL;
     return 0;
 }
 
-static ssize_t dev_write(struct file *file, const char __user *buffer, size_t len, loff_t *offset)
+static bool hid_injector_job_done(struct hid_injector_dev *dev, struct hid_injector_job *job)
 {
-    struct hid_injector_dev *dev = file->private_data;
-    char *kbd_buf;
-    u8 report[8] = {0};
-    int i;
+    unsigned long flags;
+    bool done;
 
-    if (!dev) {
-        return -ENODEV;
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    done = job->done;
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+    return done;
+}
+
+/* True while the job waits on its client's queue, including after the scheduler handed it back */
+static bool hid_injector_job_queued(struct hid_injector_dev *dev, struct hid_injector_job *job)
+{
+    unsigned long flags;
+    bool queued;
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    queued = !job->done && !list_empty(&job->node);
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+    return queued;
+}
+
+/*
+ * Takes a job that has not started typing back off its queue.
+ * Returns false if the scheduler currently holds it.
+ */
+static bool hid_injector_cancel_job(struct hid_injector_dev *dev, struct hid_injector_job *job)
+{
+    unsigned long flags;
+    bool cancelled = false;
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    if (!job->done && !list_empty(&job->node)) {
+        list_del_init(&job->node);
+        dev->pending_keys -= job->nkeys - job->pos;
+        cancelled = true;
+    }
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+
+    if (cancelled) {
+        wake_up_all(&dev->job_wait);
+    }
+    return cancelled;
+}
+
+/* Completes every queued job of @client (all clients if NULL) with @status. Call with queue_lock held. */
+static void hid_injector_cancel_queued(struct hid_injector_dev *dev, struct hid_injector_client *client, int status)
+{
+    struct hid_injector_client *c;
+    struct hid_injector_job *job, *tmp;
+
+    list_for_each_entry(c, &dev->clients, node) {
+        if (client && c != client) {
+            continue;
+        }
+        list_for_each_entry_safe(job, tmp, &c->jobs, node) {
+            list_del_init(&job->node);
+            dev->pending_keys -= job->nkeys - job->pos;
+            job->status = status;
+            job->done = true;
+        }
+    }
+}
+
+/*
+ * Drops everything @client has queued (every client's if NULL) and stops the job being typed
+ * if it is one of theirs. The scheduler notices within one report interval, pulls back the
+ * reports still in flight and leaves the host with all keys up.
+ * A single client's abort also refuses its writes still on their way to the queue.
+ */
+static void hid_injector_abort(struct hid_injector_dev *dev, struct hid_injector_client *client)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    hid_injector_cancel_queued(dev, client, -ECANCELED);
+    if (client) {
+        client->aborted = true;
+    }
+    if (dev->active_job && (!client || dev->active_job->client == client)) {
+        dev->abort_active = true;
+    }
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+
+    wake_up_all(&dev->pace_wait);
+    wake_up_all(&dev->job_wait);
+}
+
+/*
+ * Stops a single job wherever it is, used when its writer is interrupted by a signal.
+ * Returns true if it was still queued, otherwise the caller has to wait for the scheduler to finish with it.
+ */
+static bool hid_injector_abort_job(struct hid_injector_dev *dev, struct hid_injector_job *job)
+{
+    unsigned long flags;
+
+    if (hid_injector_cancel_job(dev, job)) {
+        return true;
+    }
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    if (dev->active_job == job) {
+        dev->abort_active = true;
+    }
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+
+    wake_up_all(&dev->pace_wait);
+    return false;
+}
+
+/*
+ * Reserves room for the job in the pending buffer, queues it and kicks the scheduler.
+ * On an unbound device the job is completed with -ENODEV instead, for an aborted client with -ECANCELED.
+ */
+static bool hid_injector_try_queue_job(struct hid_injector_dev *dev, struct hid_injector_job *job)
+{
+    unsigned long flags;
+    bool queued = false;
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    if (dev->dead) {
+        job->status = -ENODEV;
+        job->done = true;
+        queued = true;
+    } else if (job->client->aborted) {
+        job->status = -ECANCELED;
+        job->done = true;
+        queued = true;
+    } else if (dev->pending_keys + job->nkeys <= max_pending_keys) {
+        dev->pending_keys += job->nkeys;
+        list_add_tail(&job->node, &job->client->jobs);
+        /* Under the lock, so unbind can't destroy the workqueue in between */
+        queue_work(dev->inject_wq, &dev->inject_work);
+        queued = true;
+    }
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+    return queued;
+}
+
+/*
+ * Waits for the job to be typed. Writes are accepted before the host has configured
+ * the device, they just sit in the queue, but time spent unconfigured is bounded by
+ * unconfigured_timeout_ms, counted afresh every time the link goes down.
+ * Time spent behind other writers on a live link is not bounded.
+ * A signal stops the job, the wait for the scheduler to let go of it is one report interval at most.
+ */
+static int hid_injector_wait_job(struct hid_injector_dev *dev, struct hid_injector_job *job)
+{
+    long remaining = msecs_to_jiffies(unconfigured_timeout_ms);
+
+    while (!hid_injector_job_done(dev, job)) {
+        if (READ_ONCE(dev->interface_active)) {
+            if (wait_event_interruptible(dev->job_wait,
+                                         hid_injector_job_done(dev, job) || !READ_ONCE(dev->interface_active))) {
+                goto interrupted;
+            }
+            /* If the link dropped, the unconfigured budget starts over */
+            remaining = msecs_to_jiffies(unconfigured_timeout_ms);
+            continue;
+        }
+
+        remaining = wait_event_interruptible_timeout(dev->job_wait,
+                                                     hid_injector_job_done(dev, job) || READ_ONCE(dev->interface_active),
+                                                     remaining);
+        if (remaining < 0) {
+            goto interrupted;
+        }
+        if (remaining == 0 && !READ_ONCE(dev->interface_active)) {
+            if (hid_injector_cancel_job(dev, job)) {
+                return -ETIMEDOUT;
+            }
+            /* The scheduler is handing it back, check again shortly */
+            remaining = 1;
+        }
+    }
+    return job->status;
+
+interrupted:
+    /*
+     * A suspend or unplug can make the scheduler hand the job back to the queue before it
+     * sees the abort, so keep at it until the job is cancelled there or finished.
+     */
+    while (!hid_injector_abort_job(dev, job)) {
+        wait_event(dev->job_wait, hid_injector_job_done(dev, job) || hid_injector_job_queued(dev, job));
+        if (hid_injector_job_done(dev, job)) {
+            break;
+        }
     }
+    /* Not -ERESTARTSYS, a restarted write would type the keys already sent a second time */
+    return -EINTR;
+}
+
+/* MODE_ASCII: translate text into job->keys, skipping characters we have no key for */
+static int hid_injector_translate_ascii(struct hid_injector_job *job, const char __user *buffer, size_t len)
+{
+    char *kbd_buf;
+    size_t i;
 
     kbd_buf = memdup_user(buffer, len);
     if (IS_ERR(kbd_buf)) {
         return PTR_ERR(kbd_buf);
     }
 
-    pr_info("%s: Received string to type: %.*s\n", DRIVER_NAME, (int)len, kbd_buf);
+    pr_debug("%s: Received string to type: %.*s\n", DRIVER_NAME, (int)len, kbd_buf);
+
+    job->keys = kvmalloc_array(len, sizeof(*job->keys), GFP_KERNEL);
+    if (!job->keys) {
+        kfree(kbd_buf);
+        return -ENOMEM;
+    }
 
     for (i = 0; i < len; i++) {
         u8 modifier = 0;
-        u8 keycode = char_to_hid_keycode(kbd_buf[i], &modifier);
+        u8 keycode = hid_injector_char_to_keycode(kbd_buf[i], &modifier);
 
         if (keycode == 0) {
-            pr_warn("%s: Skipping unsupported character '%c'\n", DRIVER_NAME, kbd_buf[i]);
+            pr_warn_ratelimited("%s: Skipping unsupported character '%c'\n", DRIVER_NAME, kbd_buf[i]);
             continue;
         }
 
-        /* 1. Send Key Press Report */
-        report[0] = modifier; /* Set Modifier (e.g., Shift) */
-        report[2] = keycode;  /* Set Keycode */
-        hid_injector_send_report(dev, report);
+        job->keys[job->nkeys].modifier = modifier;
+        job->keys[job->nkeys].keycode = keycode;
+        job->nkeys++;
+    }
 
-        msleep(20);
+    kfree(kbd_buf);
+    return 0;
+}
 
-        /* 2. Send Key Release Report (all keys and modifiers up) */
-        report[0] = 0;
-        report[2] = 0;
-        hid_injector_send_report(dev, report);
+/* MODE_KEYS: the client already translated, the buffer is the job */
+static int hid_injector_copy_keys(struct hid_injector_job *job, const char __user *buffer, size_t len)
+{
+    if (len % sizeof(*job->keys)) {
+        return -EINVAL;
+    }
+    /* Before allocating, or any opener could make us vmalloc a huge buffer just to refuse it */
+    if (len / sizeof(*job->keys) > max_pending_keys) {
+        return -EMSGSIZE;
     }
 
-    kfree(kbd_buf);
-    return len;
+    job->keys = kvmalloc(len, GFP_KERNEL);
+    if (!job->keys) {
+        return -ENOMEM;
+    }
+    if (copy_from_user(job->keys, buffer, len)) {
+        return -EFAULT;
+    }
+    job->nkeys = len / sizeof(*job->keys);
+    return 0;
 }
 
+/*
+ * Translates the whole buffer up front (unless the client did that already) and hands it
+ * to the scheduler as a single job, then sleeps until it has been typed. Concurrent writers
+ * each get their payload typed atomically instead of interleaving character by character.
+ */
+static ssize_t dev_write(struct file *file, const char __user *buffer, size_t len, loff_t *offset)
+{
+    struct hid_injector_client *client = file->private_data;
+    struct hid_injector_dev *dev = client->dev;
+    struct hid_injector_job *job;
+    ssize_t ret;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    job = kzalloc(sizeof(*job), GFP_KERNEL);
+    if (!job) {
+        return -ENOMEM;
+    }
+    INIT_LIST_HEAD(&job->node);
+    job->client = client;
+
+    if (READ_ONCE(client->mode) == HID_INJECTOR_MODE_KEYS) {
+        ret = hid_injector_copy_keys(job, buffer, len);
+    } else {
+        ret = hid_injector_translate_ascii(job, buffer, len);
+    }
+    if (ret) {
+        goto out;
+    }
+
+    if (job->nkeys == 0) {
+        ret = len;
+        goto out;
+    }
+    if (job->nkeys > max_pending_keys) {
+        ret = -EMSGSIZE;
+        goto out;
+    }
+
+    /* The buffer is shared by all writers, wait for the others to drain if it is full. An abort ends the wait too */
+    ret = wait_event_interruptible_timeout(dev->job_wait, hid_injector_try_queue_job(dev, job),
+                                           msecs_to_jiffies(unconfigured_timeout_ms));
+    if (ret <= 0) {
+        ret = ret ? ret : -ENOBUFS;
+        goto out;
+    }
+
+    ret = hid_injector_wait_job(dev, job);
+    if (ret == 0) {
+        ret = len;
+    }
+
+out:
+    kvfree(job->keys);
+    kfree(job);
+    return ret;
+}
+
+/*
+ * Reading the device returns a one line status, including how long the last
+ * plug took to get from the first control request to the first keystroke.
+ */
 static ssize_t dev_read(struct file *file, char __user *buffer, size_t len, loff_t *offset)
 {
-    const char *kernel_msg = "Hello World from the kernel space";
-    size_t msg_len = strlen(kernel_msg);
+    struct hid_injector_client *client = file->private_data;
+    struct hid_injector_dev *dev = client->dev;
+    char kernel_msg[192];
+    size_t msg_len;
     size_t to_copy;
+    unsigned long flags;
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    msg_len = scnprintf(kernel_msg, sizeof(kernel_msg),
+                        "configured=%d suspended=%d pending_keys=%zu enum_us=%lld enable_us=%lld first_key_us=%lld\n",
+                        dev->interface_active, dev->suspended, dev->pending_keys,
+                        dev->enum_us, dev->enable_us, dev->first_key_us);
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
 
     if (*offset >= msg_len) {
         return 0; /* End of file */
     }
 
-    to_copy = min(len, msg_len - *offset);
+    to_copy = min(len, msg_len - (size_t)*offset);
 
     if (copy_to_user(buffer, kernel_msg + *offset, to_copy)) {
         return -EFAULT;
@@ -209,124 +633,413 @@ static ssize_t dev_read(struct file *file, char __user *buffer, size_t len, loff
     return to_copy;
 }
 
-/*
- * Transparency notice: GenAI created function, this is to ensure debugging goes smoothly.
- * and to prevent my own mistakes from creating any misdebugged things.
- * Translates an ASCII character to a USB HID keycode and determines
- * if the Shift modifier is needed.
- *
- * @c: The character to translate.
- * @modifier: A pointer to a u8 that will be set to MOD_LEFT_SHIFT if needed.
- *
- * Returns: The HID keycode, or 0 for an unsupported character.
- */
-static u8 char_to_hid_keycode(const char c, u8 *modifier)
-{
-    *modifier = 0; // Default to no modifier
-
-    if (c >= 'a' && c <= 'z') {
-        return 0x04 + (c - 'a');
-    }
-    if (c >= 'A' && c <= 'Z') {
-        *modifier = MOD_LEFT_SHIFT;
-        return 0x04 + (c - 'A');
-    }
-    if (c >= '1' && c <= '9') {
-        return 0x1E + (c - '1');
-    }
-
-    switch (c) {
-        case '0': return 0x27;
-        case '\n': return 0x28; /* Enter */
-        case '\t': return 0x2B; /* Tab */
-        case ' ': return 0x2C;  /* Spacebar */
-        case '-': return 0x2D;
-        case '=': return 0x2E;
-        case '[': return 0x2F;
-        case ']': return 0x30;
-        case '\\': return 0x31;
-        case ';': return 0x33;
-        case '\'': return 0x34;
-        case '`': return 0x35;
-        case ',': return 0x36;
-        case '.': return 0x37;
-        case '/': return 0x38;
-
-        /* Characters requiring Shift */
-        case '!': *modifier = MOD_LEFT_SHIFT; return 0x1E; /* 1 */
-        case '@': *modifier = MOD_LEFT_SHIFT; return 0x1F; /* 2 */
-        case '#': *modifier = MOD_LEFT_SHIFT; return 0x20; /* 3 */
-        case '$': *modifier = MOD_LEFT_SHIFT; return 0x21; /* 4 */
-        case '%': *modifier = MOD_LEFT_SHIFT; return 0x22; /* 5 */
-        case '^': *modifier = MOD_LEFT_SHIFT; return 0x23; /* 6 */
-        case '&': *modifier = MOD_LEFT_SHIFT; return 0x24; /* 7 */
-        case '*': *modifier = MOD_LEFT_SHIFT; return 0x25; /* 8 */
-        case '(': *modifier = MOD_LEFT_SHIFT; return 0x26; /* 9 */
-        case ')': *modifier = MOD_LEFT_SHIFT; return 0x27; /* 0 */
-        case '_': *modifier = MOD_LEFT_SHIFT; return 0x2D; /* - */
-        case '+': *modifier = MOD_LEFT_SHIFT; return 0x2E; /* = */
-        case '{': *modifier = MOD_LEFT_SHIFT; return 0x2F; /* [ */
-        case '}': *modifier = MOD_LEFT_SHIFT; return 0x30; /* ] */
-        case '|': *modifier = MOD_LEFT_SHIFT; return 0x31; /* \ */
-        case ':': *modifier = MOD_LEFT_SHIFT; return 0x33; /* ; */
-        case '"': *modifier = MOD_LEFT_SHIFT; return 0x34; /* ' */
-        case '~': *modifier = MOD_LEFT_SHIFT; return 0x35; /* ` */
-        case '<': *modifier = MOD_LEFT_SHIFT; return 0x36; /* , */
-        case '>': *modifier = MOD_LEFT_SHIFT; return 0x37; /* . */
-        case '?': *modifier = MOD_LEFT_SHIFT; return 0x38; /* / */
-
-        default: return 0; /* Unsupported character */
+static long dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct hid_injector_client *client = file->private_data;
+    struct hid_injector_progress progress;
+    struct hid_injector_gap_hist gaps;
+    unsigned long flags;
+    int priority;
+    int mode;
+
+    switch (cmd) {
+    case HID_INJECTOR_IOC_SET_PRIORITY:
+        if (get_user(priority, (int __user *)arg)) {
+            return -EFAULT;
+        }
+        spin_lock_irqsave(&client->dev->queue_lock, flags);
+        client->priority = priority;
+        spin_unlock_irqrestore(&client->dev->queue_lock, flags);
+        return 0;
+    case HID_INJECTOR_IOC_SET_MODE:
+        if (get_user(mode, (int __user *)arg)) {
+            return -EFAULT;
+        }
+        if (mode != HID_INJECTOR_MODE_ASCII && mode != HID_INJECTOR_MODE_KEYS) {
+            return -EINVAL;
+        }
+        WRITE_ONCE(client->mode, mode);
+        return 0;
+    case HID_INJECTOR_IOC_GET_PROGRESS:
+        progress.keys_typed = atomic64_read(&client->keys_typed);
+        progress.first_key_ns = atomic64_read(&client->first_key_ns);
+        if (copy_to_user((void __user *)arg, &progress, sizeof(progress))) {
+            return -EFAULT;
+        }
+        return 0;
+    case HID_INJECTOR_IOC_GET_GAP_HIST:
+        spin_lock_irqsave(&client->dev->queue_lock, flags);
+        gaps = client->dev->gaps;
+        memset(&client->dev->gaps, 0, sizeof(client->dev->gaps));
+        spin_unlock_irqrestore(&client->dev->queue_lock, flags);
+        if (copy_to_user((void __user *)arg, &gaps, sizeof(gaps))) {
+            return -EFAULT;
+        }
+        return 0;
+    case HID_INJECTOR_IOC_ABORT:
+        hid_injector_abort(client->dev, client);
+        return 0;
+    case HID_INJECTOR_IOC_ABORT_ALL:
+        hid_injector_abort(client->dev, NULL);
+        return 0;
+    case HID_INJECTOR_IOC_RESUME:
+        spin_lock_irqsave(&client->dev->queue_lock, flags);
+        client->aborted = false;
+        spin_unlock_irqrestore(&client->dev->queue_lock, flags);
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+/* Called from the completion of a press report, with queue_lock held */
+static void hid_injector_record_gap(struct hid_injector_dev *dev, ktime_t now)
+{
+    struct hid_injector_gap_hist *gaps = &dev->gaps;
+    u64 gap_us;
+
+    if (dev->last_press_ts) {
+        gap_us = ktime_us_delta(now, dev->last_press_ts);
+        gaps->buckets[min_t(u64, div_u64(gap_us, 1000), HID_INJECTOR_GAP_BUCKETS - 1)]++;
+        if (!gaps->count || gap_us < gaps->min_us) {
+            gaps->min_us = gap_us;
+        }
+        gaps->max_us = max_t(u64, gaps->max_us, gap_us);
+        gaps->sum_us += gap_us;
+        gaps->count++;
     }
+    dev->last_press_ts = now;
 }
 
 /*
  * completion callback for our sent USB requests.
- * This function is called by the UDC driver after a report is sent.
- * Its job is to free the memory we allocated for the request.
+ * This function is called by the UDC driver after a report is sent (or dequeued).
+ * Its job is to hand the request back to the pool.
  */
 static void hid_injector_complete(struct usb_ep *ep, struct usb_request *req)
 {
-    kfree(req->buf);
-    usb_ep_free_request(ep, req);
+    struct hid_injector_dev *dev = req->context;
+    unsigned long flags;
+    int i;
+
+    /* A press is any report with a keycode in it, the host just read it */
+    if (!req->status && ((u8 *)req->buf)[2]) {
+        spin_lock_irqsave(&dev->queue_lock, flags);
+        hid_injector_record_gap(dev, ktime_get());
+        spin_unlock_irqrestore(&dev->queue_lock, flags);
+    }
+
+    /* -ESHUTDOWN is a disconnect and -ECONNRESET our own dequeue, neither leaves a key to worry about */
+    if (req->status && req->status != -ESHUTDOWN && req->status != -ECONNRESET) {
+        pr_warn_ratelimited("%s: hid report failed, status %d\n", DRIVER_NAME, req->status);
+        atomic_set(&dev->report_failed, 1);
+    }
+
+    for (i = 0; i < REPORT_REQ_COUNT; i++) {
+        if (dev->report_reqs[i] == req) {
+            clear_bit(i, &dev->report_busy);
+            break;
+        }
+    }
+    wake_up(&dev->pace_wait);
+}
+
+static void hid_injector_free_reports(struct hid_injector_dev *dev)
+{
+    int i;
+
+    for (i = 0; i < REPORT_REQ_COUNT; i++) {
+        if (dev->report_reqs[i]) {
+            kfree(dev->report_reqs[i]->buf);
+            usb_ep_free_request(dev->report_ep, dev->report_reqs[i]);
+            dev->report_reqs[i] = NULL;
+        }
+    }
+    dev->report_busy = 0;
+    dev->report_ep = NULL;
+}
+
+/* Allocates the IN request pool for @ep, kept across reconnects as long as the endpoint stays the same */
+static int hid_injector_alloc_reports(struct hid_injector_dev *dev, struct usb_ep *ep)
+{
+    struct usb_request *req;
+    int i;
+
+    if (dev->report_ep == ep) {
+        return 0;
+    }
+    hid_injector_free_reports(dev);
+    dev->report_ep = ep;
+
+    for (i = 0; i < REPORT_REQ_COUNT; i++) {
+        req = usb_ep_alloc_request(ep, GFP_KERNEL);
+        if (!req) {
+            goto fail;
+        }
+        req->buf = kmalloc(8, GFP_KERNEL);
+        if (!req->buf) {
+            usb_ep_free_request(ep, req);
+            goto fail;
+        }
+        req->length = 8;
+        req->complete = hid_injector_complete;
+        req->context = dev;
+        dev->report_reqs[i] = req;
+    }
+    return 0;
+
+fail:
+    hid_injector_free_reports(dev);
+    return -ENOMEM;
+}
+
+static int hid_injector_get_report_slot(struct hid_injector_dev *dev)
+{
+    int i;
+
+    for (i = 0; i < REPORT_REQ_COUNT; i++) {
+        if (!test_and_set_bit(i, &dev->report_busy)) {
+            return i;
+        }
+    }
+    return -1;
 }
 
 /*
  * Builds and sends a single 8-byte HID report to the host.
+ * Only the scheduler calls this, so it may sleep waiting for a free request.
  */
 static int hid_injector_send_report(struct hid_injector_dev *dev, u8 *report)
 {
     struct usb_request *req;
+    int slot = -1;
     int status;
 
-    if (!dev->interface_active || !dev->in_ep) {
+    if (!dev->interface_active || !dev->in_ep || dev->report_ep != dev->in_ep) {
         return -ENODEV;
     }
 
-    req = usb_ep_alloc_request(dev->in_ep, GFP_ATOMIC);
-    if (!req) {
-        return -ENOMEM;
+    /* Every request still queued means the host is not polling, give it a moment */
+    if (!wait_event_timeout(dev->pace_wait,
+                            (slot = hid_injector_get_report_slot(dev)) >= 0 || READ_ONCE(dev->abort_active),
+                            HZ)) {
+        return -ETIMEDOUT;
     }
-
-    req->buf = kmalloc(8, GFP_ATOMIC);
-    if (!req->buf) {
-        usb_ep_free_request(dev->in_ep, req);
-        return -ENOMEM;
+    if (slot < 0) {
+        return -ECANCELED;
     }
 
-    req->length = 8;
-    req->complete = hid_injector_complete;
-    req->context = dev;
+    req = dev->report_reqs[slot];
     memcpy(req->buf, report, 8);
 
     status = usb_ep_queue(dev->in_ep, req, GFP_ATOMIC);
     if (status) {
         pr_err("%s: failed to queue hid report, status %d\n", DRIVER_NAME, status);
-        /* If queueing fails, we must clean up immediately */
-        kfree(req->buf);
-        usb_ep_free_request(dev->in_ep, req);
+        clear_bit(slot, &dev->report_busy);
+        return status;
     }
 
-    return status;
+    if (!dev->first_key_sent) {
+        dev->first_key_sent = true;
+        dev->first_key_us = ktime_us_delta(ktime_get(), dev->ready_ts);
+        pr_info("%s: first keystroke %lld us after plug (enumeration %lld us, enable %lld us, queue %lld us)\n",
+                DRIVER_NAME, dev->enum_us + dev->enable_us + dev->first_key_us,
+                dev->enum_us, dev->enable_us, dev->first_key_us);
+    }
+
+    return 0;
+}
+
+/*
+ * Picks the next job to type: the highest priority client with work pending wins,
+ * and a client that was just served moves to the back of the list so that
+ * clients of equal priority are served round-robin.
+ */
+static struct hid_injector_job *hid_injector_next_job(struct hid_injector_dev *dev)
+{
+    struct hid_injector_client *client, *best = NULL;
+    struct hid_injector_job *job = NULL;
+    unsigned long flags;
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    if (!dev->interface_active || dev->dead) {
+        /* Keep everything buffered, the scheduler is kicked again once the endpoint is up */
+        spin_unlock_irqrestore(&dev->queue_lock, flags);
+        return NULL;
+    }
+    if (dev->suspended) {
+        /* Same for a suspended bus, jobs keep their place and resume with the host */
+        spin_unlock_irqrestore(&dev->queue_lock, flags);
+        return NULL;
+    }
+    list_for_each_entry(client, &dev->clients, node) {
+        if (list_empty(&client->jobs)) {
+            continue;
+        }
+        if (!best || client->priority > best->priority) {
+            best = client;
+        }
+    }
+    if (best) {
+        job = list_first_entry(&best->jobs, struct hid_injector_job, node);
+        list_del_init(&job->node);
+        list_move_tail(&best->node, &dev->clients);
+        dev->active_job = job;
+        dev->last_press_ts = 0; /* Time between jobs is not a key gap */
+    }
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+
+    return job;
+}
+
+static int hid_injector_type_job(struct hid_injector_dev *dev, struct hid_injector_job *job)
+{
+    u8 report[8] = {0};
+    int status;
+
+    /* If the host may have missed a release, make sure it sees all keys up before we go on */
+    if (atomic_xchg(&dev->report_failed, 0)) {
+        status = hid_injector_send_report(dev, report);
+        if (status) {
+            return status;
+        }
+    }
+
+    for (; job->pos < job->nkeys; job->pos++) {
+        if (READ_ONCE(dev->abort_active)) {
+            return -ECANCELED;
+        }
+        /* Only stop between keys, so a suspend never leaves a key held down */
+        if (READ_ONCE(dev->suspended)) {
+            return -EAGAIN;
+        }
+
+        /* 1. Send Key Press Report */
+        report[0] = job->keys[job->pos].modifier; /* Set Modifier (e.g., Shift) */
+        report[2] = job->keys[job->pos].keycode;  /* Set Keycode */
+        status = hid_injector_send_report(dev, report);
+        if (status) {
+            return status;
+        }
+        if (job->pos == 0) {
+            atomic64_set(&job->client->first_key_ns, ktime_get_ns());
+        }
+
+        /*
+         * Hold the key, an abort cuts the hold short and the caller releases everything.
+         * An hrtimer rather than jiffies, so the hold is KEY_HOLD_MS and not up to a tick more.
+         */
+        if (!wait_event_hrtimeout(dev->pace_wait, READ_ONCE(dev->abort_active), ms_to_ktime(KEY_HOLD_MS))) {
+            return -ECANCELED;
+        }
+
+        /* 2. Send Key Release Report (all keys and modifiers up) */
+        report[0] = 0;
+        report[2] = 0;
+        status = hid_injector_send_report(dev, report);
+        if (status) {
+            return status;
+        }
+        atomic64_inc(&job->client->keys_typed);
+    }
+    return 0;
+}
+
+/*
+ * After an abort: pull back every report the host has not read yet and
+ * send a final empty report so nothing is left held down.
+ */
+static void hid_injector_all_keys_up(struct hid_injector_dev *dev)
+{
+    u8 report[8] = {0};
+    int i;
+
+    if (!dev->in_ep || dev->report_ep != dev->in_ep) {
+        return;
+    }
+
+    for (i = 0; i < REPORT_REQ_COUNT; i++) {
+        if (test_bit(i, &dev->report_busy)) {
+            usb_ep_dequeue(dev->in_ep, dev->report_reqs[i]);
+        }
+    }
+    hid_injector_send_report(dev, report);
+}
+
+/*
+ * A suspended host will not poll us, so pending keys would wait for the host to wake up
+ * on its own. If enabled, ask the host to resume instead, once per suspend.
+ */
+static void hid_injector_request_wakeup(struct hid_injector_dev *dev)
+{
+    unsigned long flags;
+    bool wake = false;
+    int status;
+
+    if (!remote_wakeup) {
+        return;
+    }
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    if (dev->suspended && !dev->wakeup_requested && dev->pending_keys) {
+        dev->wakeup_requested = true;
+        wake = true;
+    }
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+
+    if (!wake) {
+        return;
+    }
+
+    status = usb_gadget_wakeup(dev->gadget);
+    if (status) {
+        pr_warn("%s: remote wakeup failed, status %d (host may not have armed it)\n", DRIVER_NAME, status);
+    } else {
+        pr_info("%s: remote wakeup signalled, keys pending\n", DRIVER_NAME);
+    }
+}
+
+/*
+ * The scheduler. This is the only place reports are sent from, so the IN endpoint
+ * never sees two writers at once. It drains jobs back to back until every queue is empty.
+ */
+static void hid_inject_work_handler(struct work_struct *w)
+{
+    struct hid_injector_dev *dev = container_of(w, struct hid_injector_dev, inject_work);
+    struct hid_injector_job *job;
+    unsigned long flags;
+    int status;
+
+    while ((job = hid_injector_next_job(dev)) != NULL) {
+        size_t start = job->pos;
+
+        status = hid_injector_type_job(dev, job);
+
+        spin_lock_irqsave(&dev->queue_lock, flags);
+        if (dev->abort_active && status) {
+            status = dev->dead ? -ENODEV : -ECANCELED;
+        }
+        dev->abort_active = false;
+        dev->active_job = NULL;
+        dev->pending_keys -= job->pos - start;
+        if (status && status != -ECANCELED && !dev->dead && (!dev->interface_active || dev->suspended)) {
+            /* Unplugged or suspended mid-job: put it back at the front, it resumes with the host */
+            list_add(&job->node, &job->client->jobs);
+        } else {
+            dev->pending_keys -= job->nkeys - job->pos;
+            job->status = status;
+            job->done = true;
+        }
+        spin_unlock_irqrestore(&dev->queue_lock, flags);
+
+        /* job belongs to its writer again from here on, do not touch it */
+        if (status == -ECANCELED) {
+            hid_injector_all_keys_up(dev);
+        }
+        wake_up_all(&dev->job_wait);
+    }
+
+    hid_injector_request_wakeup(dev);
 }
 
 static int handle_string_request(struct usb_request *req, u8 index)
@@ -381,6 +1094,10 @@ static void hid_set_config_work_handler(struct work_struct *w)
 
     pr_info("%s: --- Running set_config work handler ---\n", DRIVER_NAME);
 
+    if (dev->interface_active) {
+        return; /* Host re-sent SET_CONFIGURATION, the endpoint is already up */
+    }
+
     /* Locate our endpoint descriptor just for reference and to assign later */
     ep_desc = (const struct usb_endpoint_descriptor *)&config_desc_raw[27];
 
@@ -400,8 +1117,7 @@ static void hid_set_config_work_handler(struct work_struct *w)
     }
 
     if (!dev->in_ep) {
-        pr_err("%s: Failed to find any compatible Interrupt IN endpoint. Aborting.\n", DRIVER_NAME);
-        return;
+        goto retry;
     }
 
     /*
@@ -412,15 +1128,43 @@ static void hid_set_config_work_handler(struct work_struct *w)
     dev->in_ep->desc = ep_desc;
     dev->in_ep->driver_data = dev;
 
-    status = usb_ep_enable(dev->in_ep);
-    if (status == 0) {
-        dev->interface_active = true;
-        pr_info("%s: IN endpoint '%s' enabled successfully.\n", DRIVER_NAME, dev->in_ep->name);
-    } else {
-        pr_err("%s: Failed to enable IN endpoint '%s', status %d\n", DRIVER_NAME, dev->in_ep->name, status);
+    if (hid_injector_alloc_reports(dev, dev->in_ep)) {
+        pr_err("%s: Failed to allocate IN requests. Aborting.\n", DRIVER_NAME);
         dev->in_ep->desc = NULL;
         dev->in_ep = NULL;
+        return;
     }
+
+    status = usb_ep_enable(dev->in_ep);
+    if (status == 0) {
+        dev->ready_ts = ktime_get();
+        dev->enable_us = ktime_us_delta(dev->ready_ts, dev->config_ts);
+        dev->first_key_sent = false;
+        WRITE_ONCE(dev->interface_active, true);
+        pr_info("%s: IN endpoint '%s' enabled successfully after %d tries, %lld us after SET_CONFIGURATION.\n",
+                DRIVER_NAME, dev->in_ep->name, dev->ep_enable_tries + 1, dev->enable_us);
+
+        /* Flush whatever was written while we were waiting for the host */
+        wake_up_all(&dev->job_wait);
+        queue_work(dev->inject_wq, &dev->inject_work);
+        return;
+    }
+
+    pr_warn("%s: Failed to enable IN endpoint '%s', status %d\n", DRIVER_NAME, dev->in_ep->name, status);
+    dev->in_ep->desc = NULL;
+    dev->in_ep = NULL;
+
+retry:
+    /*
+     * dwc2 may still be setting the endpoints up right after SET_CONFIGURATION.
+     * Rather than always paying a fixed delay, try again on the next tick until it works.
+     */
+    if (++dev->ep_enable_tries < EP_ENABLE_MAX_TRIES) {
+        schedule_delayed_work(&dev->set_config_work, 1);
+        return;
+    }
+    pr_err("%s: Failed to bring up an Interrupt IN endpoint after %d tries. Aborting.\n",
+           DRIVER_NAME, dev->ep_enable_tries);
 }
 
 static int legacy_setup(struct usb_gadget *gadget, const struct usb_ctrlrequest *ctrl)
@@ -428,6 +1172,7 @@ static int legacy_setup(struct usb_gadget *gadget, const struct usb_ctrlrequest
     struct hid_injector_dev *dev = dev_get_drvdata(&gadget->dev);
     struct usb_request *req = dev->req0;
     int value = -EOPNOTSUPP;
+    unsigned long flags;
     u16 w_length = le16_to_cpu(ctrl->wLength);
     u16 w_value = le16_to_cpu(ctrl->wValue);
     u8 desc_type = w_value >> 8;
@@ -436,6 +1181,11 @@ static int legacy_setup(struct usb_gadget *gadget, const struct usb_ctrlrequest
     req->zero = 0;
     req->complete = NULL;
 
+    /* The first control request after bind/disconnect marks the plug for the latency stats */
+    if (!dev->connect_ts) {
+        dev->connect_ts = ktime_get();
+    }
+
     switch (ctrl->bRequestType) {
     case USB_DIR_IN | USB_TYPE_STANDARD | USB_RECIP_DEVICE:
         if (ctrl->bRequest == USB_REQ_GET_DESCRIPTOR) {
@@ -447,6 +1197,10 @@ static int legacy_setup(struct usb_gadget *gadget, const struct usb_ctrlrequest
             case USB_DT_CONFIG:
                 value = min_t(unsigned, sizeof(config_desc_raw), w_length);
                 memcpy(req->buf, &config_desc_raw, value);
+                /* bmAttributes, only claim remote wakeup when we are going to use it */
+                if (remote_wakeup && value > 7) {
+                    ((u8 *)req->buf)[7] |= USB_CONFIG_ATT_WAKEUP;
+                }
                 break;
             case USB_DT_STRING:
                 value = handle_string_request(req, desc_idx);
@@ -464,8 +1218,26 @@ static int legacy_setup(struct usb_gadget *gadget, const struct usb_ctrlrequest
 
     case USB_DIR_OUT | USB_TYPE_STANDARD | USB_RECIP_DEVICE:
         if (ctrl->bRequest == USB_REQ_SET_CONFIGURATION && w_value == 1) {
-            /* schedule with a delay to avoid a race with the UDC driver. This prevents null references. */
-            schedule_delayed_work(&dev->set_config_work, msecs_to_jiffies(20));
+            /* enabling can race the UDC driver, the work handler retries until the endpoint comes up. */
+            dev->config_ts = ktime_get();
+            dev->enum_us = ktime_us_delta(dev->config_ts, dev->connect_ts);
+            dev->ep_enable_tries = 0;
+            schedule_delayed_work(&dev->set_config_work, 0);
+
+            /*
+             * A host that reset-resumes the port configures us again without resume signalling,
+             * so legacy_resume() never runs. Being configured means the bus is awake.
+             */
+            spin_lock_irqsave(&dev->queue_lock, flags);
+            dev->suspended = false;
+            dev->wakeup_requested = false;
+            spin_unlock_irqrestore(&dev->queue_lock, flags);
+            queue_work(dev->inject_wq, &dev->inject_work);
+            value = 0;
+        }
+        /* Most UDCs (dwc2 included) handle this themselves, ack it for the ones that don't. */
+        if ((ctrl->bRequest == USB_REQ_SET_FEATURE || ctrl->bRequest == USB_REQ_CLEAR_FEATURE) &&
+            w_value == USB_DEVICE_REMOTE_WAKEUP && remote_wakeup) {
             value = 0;
         }
         break;
@@ -494,18 +1266,65 @@ static void legacy_disconnect(struct usb_gadget *gadget)
         return;
     }
 
-    dev->interface_active = false;
+    WRITE_ONCE(dev->interface_active, false);
+    WRITE_ONCE(dev->suspended, false);
+    dev->connect_ts = 0;
     /* Use the sync version to ensure work is finished before we proceed. */
     cancel_delayed_work_sync(&dev->set_config_work);
     if (dev->in_ep) {
         usb_ep_disable(dev->in_ep);
     }
+    /* Writers start counting their unconfigured timeout again */
+    wake_up_all(&dev->job_wait);
     pr_info("%s: gadget disconnected\n", DRIVER_NAME);
 }
 
+/*
+ * Called from interrupt context when the host suspends the bus.
+ * Nothing is dropped: the scheduler stops at the next key boundary and the job goes back to the
+ * front of its queue. Writers keep waiting, a suspended link does not count as unconfigured.
+ */
+static void legacy_suspend(struct usb_gadget *gadget)
+{
+    struct hid_injector_dev *dev = dev_get_drvdata(&gadget->dev);
+    unsigned long flags;
+
+    if (!dev) {
+        return;
+    }
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    dev->suspended = true;
+    dev->wakeup_requested = false;
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+
+    /* Lets the scheduler signal remote wakeup if something is already pending */
+    queue_work(dev->inject_wq, &dev->inject_work);
+    pr_info("%s: host suspended the bus\n", DRIVER_NAME);
+}
+
+static void legacy_resume(struct usb_gadget *gadget)
+{
+    struct hid_injector_dev *dev = dev_get_drvdata(&gadget->dev);
+    unsigned long flags;
+
+    if (!dev) {
+        return;
+    }
+
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    dev->suspended = false;
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+
+    /* Pick up right where we stopped */
+    queue_work(dev->inject_wq, &dev->inject_work);
+    pr_info("%s: host resumed the bus\n", DRIVER_NAME);
+}
+
 static void legacy_unbind(struct usb_gadget *gadget)
 {
     struct hid_injector_dev *dev = dev_get_drvdata(&gadget->dev);
+    unsigned long flags;
 
     /* It's possible unbind is called on a device that failed bind. Always check. */
     if (!dev) {
@@ -514,12 +1333,35 @@ static void legacy_unbind(struct usb_gadget *gadget)
 
     pr_info("%s: unbinding gadget and cleaning up resources\n", DRIVER_NAME);
 
+    /* No new opens from here on */
+    mutex_lock(&g_hid_dev_lock);
+    g_hid_dev = NULL;
+    mutex_unlock(&g_hid_dev_lock);
+
+    /*
+     * Files may stay open past the unbind and keep the struct alive. Fail every write they
+     * have queued, stop the one being typed and wake everyone, so nobody sleeps on a device
+     * that is gone and nothing new reaches the workqueue.
+     */
+    spin_lock_irqsave(&dev->queue_lock, flags);
+    dev->dead = true;
+    hid_injector_cancel_queued(dev, NULL, -ENODEV);
+    if (dev->active_job) {
+        dev->abort_active = true;
+    }
+    spin_unlock_irqrestore(&dev->queue_lock, flags);
+    wake_up_all(&dev->pace_wait);
+    wake_up_all(&dev->job_wait);
+
     /*
      * Ensure any pending work is cancelled and has finished executing.
      * This is critical to prevent use-after-free bugs if the work handler
      * tries to run after we've freed memory.
      */
     cancel_delayed_work_sync(&dev->set_config_work);
+    cancel_work_sync(&dev->inject_work);
+    destroy_workqueue(dev->inject_wq);
+    hid_injector_free_reports(dev);
 
     /*
      * Step 1: Destroy the device file.
@@ -546,13 +1388,13 @@ static void legacy_unbind(struct usb_gadget *gadget)
     /* --- Final memory cleanup --- */
     kfree(dev->req0->buf);
     usb_ep_free_request(gadget->ep0, dev->req0);
-    kfree(dev);
 
     /*
      * Finally, clear the driver data pointers to prevent stale references.
+     * The struct itself goes with the last open file.
      */
     dev_set_drvdata(&gadget->dev, NULL);
-    g_hid_dev = NULL;
+    kref_put(&dev->kref, hid_injector_dev_free);
 }
 
 static int legacy_bind(struct usb_gadget *gadget, struct usb_gadget_driver *driver)
@@ -575,9 +1417,13 @@ static int legacy_bind(struct usb_gadget *gadget, struct usb_gadget_driver *driv
     }
 
     // link our state struct with the kernel's gadget device.
+    // the binding holds the first reference, every open file takes another.
+    kref_init(&dev->kref);
     dev->gadget = gadget;
     dev_set_drvdata(&gadget->dev, dev);
+    mutex_lock(&g_hid_dev_lock);
     g_hid_dev = dev;
+    mutex_unlock(&g_hid_dev_lock);
 
     // preallocate the EP0 request point.
     dev->req0 = usb_ep_alloc_request(gadget->ep0, GFP_ATOMIC);
@@ -595,6 +1441,20 @@ static int legacy_bind(struct usb_gadget *gadget, struct usb_gadget_driver *driv
     // if it is not async, then this will fail, causing an infinite reset loop, as DWC2 is not yet ready.
     INIT_DELAYED_WORK(&dev->set_config_work, hid_set_config_work_handler);
 
+    // writer arbitration: every open() registers a client, one work item types for all of them.
+    spin_lock_init(&dev->queue_lock);
+    INIT_LIST_HEAD(&dev->clients);
+    INIT_WORK(&dev->inject_work, hid_inject_work_handler);
+    init_waitqueue_head(&dev->job_wait);
+    init_waitqueue_head(&dev->pace_wait);
+
+    // the scheduler sleeps between every pair of reports, on a busy system the default kworkers wake late.
+    dev->inject_wq = alloc_workqueue("%s", WQ_HIGHPRI, 1, DEVICE_NAME);
+    if (!dev->inject_wq) {
+        status = -ENOMEM;
+        goto fail_req0_buf;
+    }
+
 
     /**
      * This portion enables the character device.
@@ -605,7 +1465,7 @@ static int legacy_bind(struct usb_gadget *gadget, struct usb_gadget_driver *driv
     if (dev->major < 0) {
         status = dev->major;
         pr_err("%s: failed to register char device, error %d\n", DRIVER_NAME, status);
-        goto fail_req0_buf;
+        goto fail_wq;
     }
 
     // register the character device class.
@@ -630,14 +1490,18 @@ fail_class:
     class_destroy(dev->dev_class);
 fail_chrdev:
     unregister_chrdev(dev->major, DEVICE_NAME);
+fail_wq:
+    destroy_workqueue(dev->inject_wq);
 fail_req0_buf:
     kfree(dev->req0->buf);
 fail_req0:
     usb_ep_free_request(gadget->ep0, dev->req0);
 fail:
-    kfree(dev);
+    mutex_lock(&g_hid_dev_lock);
     g_hid_dev = NULL;
+    mutex_unlock(&g_hid_dev_lock);
     dev_set_drvdata(&gadget->dev, NULL);
+    kref_put(&dev->kref, hid_injector_dev_free);
     return status;
 }
 
@@ -648,6 +1512,8 @@ static struct usb_gadget_driver legacy_driver = {
     .unbind    = legacy_unbind,
     .setup     = legacy_setup,
     .disconnect= legacy_disconnect,
+    .suspend   = legacy_suspend,
+    .resume    = legacy_resume,
     .max_speed = USB_SPEED_FULL,
 };
 
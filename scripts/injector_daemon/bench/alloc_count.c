@@ -0,0 +1,102 @@
+// alloc_count.c - LD_PRELOAD shim counting allocator calls.
+// counts malloc/calloc/realloc/free and the bytes requested, and prints them when the
+// process exits (to $ALLOC_COUNT_OUT if set, stderr otherwise).
+//
+//   LD_PRELOAD=./bench/alloc_count.so ALLOC_COUNT_OUT=counts.txt ./injector_daemon ...
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <stdatomic.h>
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+static atomic_ullong n_malloc, n_calloc, n_realloc, n_free, bytes_requested;
+
+// dlsym() itself may calloc() before real_calloc is known, serve that from here.
+static char bootstrap[4096];
+static size_t bootstrap_used;
+static int resolving;
+
+static void resolve(void) {
+    if (real_malloc != NULL || resolving) {
+        return;
+    }
+    resolving = 1;
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    resolving = 0;
+}
+
+static int from_bootstrap(void *ptr) {
+    return (char *)ptr >= bootstrap && (char *)ptr < bootstrap + sizeof(bootstrap);
+}
+
+void *malloc(size_t size) {
+    resolve();
+    atomic_fetch_add_explicit(&n_malloc, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes_requested, size, memory_order_relaxed);
+    return real_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (real_calloc == NULL) {
+        if (resolving) {
+            size_t total = (nmemb * size + 15) & ~(size_t)15;
+            if (bootstrap_used + total > sizeof(bootstrap)) {
+                return NULL;
+            }
+            void *ptr = bootstrap + bootstrap_used;
+            bootstrap_used += total;
+            return ptr; // static storage, already zeroed
+        }
+        resolve();
+    }
+    atomic_fetch_add_explicit(&n_calloc, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes_requested, nmemb * size, memory_order_relaxed);
+    return real_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    resolve();
+    atomic_fetch_add_explicit(&n_realloc, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes_requested, size, memory_order_relaxed);
+    if (from_bootstrap(ptr)) {
+        void *copy = real_malloc(size);
+        size_t avail = (size_t)(bootstrap + sizeof(bootstrap) - (char *)ptr);
+        if (copy != NULL) {
+            memcpy(copy, ptr, size < avail ? size : avail);
+        }
+        return copy;
+    }
+    return real_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if (ptr == NULL || from_bootstrap(ptr)) {
+        return;
+    }
+    resolve();
+    atomic_fetch_add_explicit(&n_free, 1, memory_order_relaxed);
+    real_free(ptr);
+}
+
+__attribute__((destructor))
+static void report(void) {
+    const char *path = getenv("ALLOC_COUNT_OUT");
+    FILE *out = path ? fopen(path, "w") : NULL;
+
+    fprintf(out ? out : stderr, "malloc=%llu calloc=%llu realloc=%llu free=%llu bytes_requested=%llu\n",
+            atomic_load(&n_malloc), atomic_load(&n_calloc), atomic_load(&n_realloc),
+            atomic_load(&n_free), atomic_load(&bytes_requested));
+    if (out) {
+        fclose(out);
+    }
+}
@@ -0,0 +1,275 @@
+// http_load.c - small HTTP POST load generator for the injector daemon's staging endpoint.
+// plain sockets and pthreads only, so it builds anywhere the daemon does.
+//
+// each worker opens a connection, sends one POST with a body of the requested size
+// (optionally dribbled out in small chunks with a delay, slow-loris style), waits for
+// the response and records the latency. prints throughput and latency percentiles at the end.
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+struct LoadConfig {
+    const char *host;
+    const char *port;
+    const char *url;
+    int concurrency;
+    int requests;            // total, shared by all workers
+    size_t min_size;         // body size, picked uniformly in [min_size, max_size]
+    size_t max_size;
+    size_t chunk;            // bytes per send(), 0 sends the body in one go
+    int chunk_delay_ms;      // pause between chunks, for slow-loris uploads
+};
+
+static struct LoadConfig g_cfg = {
+    .host = "127.0.0.1",
+    .port = "8080",
+    .url = "/",
+    .concurrency = 4,
+    .requests = 100,
+    .min_size = 1024,
+    .max_size = 1024,
+    .chunk = 0,
+    .chunk_delay_ms = 0,
+};
+
+static atomic_int g_next_request = 0;
+static atomic_int g_errors = 0;
+static atomic_ullong g_bytes_sent = 0;
+static double *g_latencies;  // seconds, one slot per request, -1 for failed requests
+static char *g_body;         // shared body text, max_size bytes
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// accepts plain numbers and k/M/G suffixes (powers of 1024).
+static size_t parse_size(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+    switch (*end) {
+    case 'k': case 'K': value *= 1024; break;
+    case 'm': case 'M': value *= 1024 * 1024; break;
+    case 'g': case 'G': value *= 1024.0 * 1024 * 1024; break;
+    default: break;
+    }
+    return (size_t)value;
+}
+
+static int connect_to_server(void) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res, *ai;
+    int fd = -1;
+
+    if (getaddrinfo(g_cfg.host, g_cfg.port, &hints, &res) != 0) {
+        return -1;
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+static int send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// one POST, returns 0 on a 200 response.
+static int do_request(size_t size) {
+    char header[512];
+    char response[1024];
+    int fd = connect_to_server();
+    if (fd < 0) {
+        return -1;
+    }
+
+    int header_len = snprintf(header, sizeof(header),
+                              "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: text/plain\r\n"
+                              "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                              g_cfg.url, g_cfg.host, size);
+    if (send_all(fd, header, (size_t)header_len) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t chunk = g_cfg.chunk ? g_cfg.chunk : size;
+    for (size_t offset = 0; offset < size; offset += chunk) {
+        size_t len = size - offset < chunk ? size - offset : chunk;
+        if (send_all(fd, g_body + offset, len) != 0) {
+            close(fd);
+            return -1;
+        }
+        atomic_fetch_add(&g_bytes_sent, len);
+        if (g_cfg.chunk_delay_ms > 0 && offset + len < size) {
+            usleep(g_cfg.chunk_delay_ms * 1000);
+        }
+    }
+
+    // only the status line matters, then drain until the server closes.
+    ssize_t got = 0, n;
+    while ((n = recv(fd, response + got, sizeof(response) - 1 - got, 0)) > 0) {
+        got += n;
+        if ((size_t)got == sizeof(response) - 1) {
+            got = 12; // keep the status line, throw the rest away
+        }
+    }
+    close(fd);
+    response[got] = '\0';
+
+    return strncmp(response, "HTTP/1.1 200", 12) == 0 || strncmp(response, "HTTP/1.0 200", 12) == 0 ? 0 : -1;
+}
+
+static void *worker(void *arg) {
+    unsigned int seed = (unsigned int)(size_t)arg;
+    int i;
+
+    while ((i = atomic_fetch_add(&g_next_request, 1)) < g_cfg.requests) {
+        size_t size = g_cfg.min_size;
+        if (g_cfg.max_size > g_cfg.min_size) {
+            size += (size_t)rand_r(&seed) % (g_cfg.max_size - g_cfg.min_size + 1);
+        }
+
+        double start = now_s();
+        if (do_request(size) == 0) {
+            g_latencies[i] = now_s() - start;
+        } else {
+            g_latencies[i] = -1;
+            atomic_fetch_add(&g_errors, 1);
+        }
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    int idx = (int)(p * (n - 1) + 0.5);
+    return sorted[idx];
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-H host] [-p port] [-u url] [-c concurrency] [-n requests]\n"
+            "          [-s size | -s min-max] [-k chunk] [-w chunk_delay_ms]\n"
+            "  sizes take k/M/G suffixes, e.g. -s 1k-32M\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:u:c:n:s:k:w:h")) != -1) {
+        switch (opt) {
+        case 'H': g_cfg.host = optarg; break;
+        case 'p': g_cfg.port = optarg; break;
+        case 'u': g_cfg.url = optarg; break;
+        case 'c': g_cfg.concurrency = atoi(optarg); break;
+        case 'n': g_cfg.requests = atoi(optarg); break;
+        case 's': {
+            char *dash = strchr(optarg, '-');
+            g_cfg.min_size = parse_size(optarg);
+            g_cfg.max_size = dash ? parse_size(dash + 1) : g_cfg.min_size;
+            break;
+        }
+        case 'k': g_cfg.chunk = parse_size(optarg); break;
+        case 'w': g_cfg.chunk_delay_ms = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (g_cfg.concurrency < 1 || g_cfg.requests < 1 || g_cfg.max_size < g_cfg.min_size) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // payload-like text: printable ASCII lines, so the daemon's translation does real work.
+    g_body = malloc(g_cfg.max_size + 1);
+    g_latencies = calloc((size_t)g_cfg.requests, sizeof(double));
+    if (g_body == NULL || g_latencies == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+    for (size_t i = 0; i < g_cfg.max_size; i++) {
+        g_body[i] = (i % 64 == 63) ? '\n' : (char)('a' + i % 26);
+    }
+
+    pthread_t *threads = calloc((size_t)g_cfg.concurrency, sizeof(pthread_t));
+    if (threads == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    double start = now_s();
+    for (int i = 0; i < g_cfg.concurrency; i++) {
+        pthread_create(&threads[i], NULL, worker, (void *)(size_t)(i + 1));
+    }
+    for (int i = 0; i < g_cfg.concurrency; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now_s() - start;
+
+    // percentiles over successful requests only.
+    int ok = 0;
+    for (int i = 0; i < g_cfg.requests; i++) {
+        if (g_latencies[i] >= 0) {
+            g_latencies[ok++] = g_latencies[i];
+        }
+    }
+    qsort(g_latencies, (size_t)ok, sizeof(double), compare_double);
+
+    unsigned long long bytes = atomic_load(&g_bytes_sent);
+    printf("requests=%d ok=%d errors=%d concurrency=%d elapsed_s=%.3f\n",
+           g_cfg.requests, ok, atomic_load(&g_errors), g_cfg.concurrency, elapsed);
+    printf("throughput_rps=%.1f throughput_MBps=%.2f\n", ok / elapsed, bytes / elapsed / (1024 * 1024));
+    printf("latency_ms p50=%.2f p90=%.2f p99=%.2f max=%.2f\n",
+           percentile(g_latencies, ok, 0.50) * 1000, percentile(g_latencies, ok, 0.90) * 1000,
+           percentile(g_latencies, ok, 0.99) * 1000, ok ? g_latencies[ok - 1] * 1000 : 0);
+
+    free(threads);
+    free(g_latencies);
+    free(g_body);
+    return atomic_load(&g_errors) ? 2 : 0;
+}
@@ -0,0 +1,198 @@
+// report_jitter.c - key timing benchmark, run on the board with the gadget plugged into a host.
+// types a run of keys (or watches someone else's, -w) while synthetic CPU and I/O load runs,
+// then prints the distribution of gaps between key presses as the host read them, taken from
+// the module's HID_INJECTOR_IOC_GET_GAP_HIST.
+//
+// the gaps are paced by the module's workqueue, our writer only submits them in one write().
+//
+//   ./bench/report_jitter -n 500 -c 4 -i 2   # our own write, under load
+//   ./bench/report_jitter -w 30 -c 4         # 30 s of load, measure the daemon's injections
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+
+#include "hid_injector.h"
+
+#define IO_BLOCK_SIZE (1024 * 1024)
+
+static const char *g_device_path = "/dev/hid_injector";
+static const char *g_io_dir = "/tmp";
+static atomic_int g_stop_load = 0;
+
+// a busy loop per thread, for run queue pressure.
+static void *cpu_hog(void *arg) {
+    volatile unsigned long spin = 0;
+    (void)arg;
+
+    while (!atomic_load(&g_stop_load)) {
+        spin++;
+    }
+    return NULL;
+}
+
+// rewrites a file and fsyncs it, over and over, for block layer and writeback pressure.
+static void *io_hog(void *arg) {
+    char path[256];
+    char *block = malloc(IO_BLOCK_SIZE);
+
+    snprintf(path, sizeof(path), "%s/report_jitter.%d.%ld", g_io_dir, getpid(), (long)(size_t)arg);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || block == NULL) {
+        perror("I/O load worker");
+        free(block);
+        return NULL;
+    }
+    unlink(path);
+    memset(block, 0x5a, IO_BLOCK_SIZE);
+
+    while (!atomic_load(&g_stop_load)) {
+        for (int i = 0; i < 16 && !atomic_load(&g_stop_load); i++) {
+            if (write(fd, block, IO_BLOCK_SIZE) < 0) {
+                break;
+            }
+        }
+        fsync(fd);
+        lseek(fd, 0, SEEK_SET);
+    }
+    close(fd);
+    free(block);
+    return NULL;
+}
+
+// smallest bucket edge (in ms) with at least fraction p of the gaps at or below it.
+static int percentile_ms(const struct hid_injector_gap_hist *h, double p) {
+    unsigned long long target = (unsigned long long)(p * h->count + 0.5);
+    unsigned long long seen = 0;
+
+    if (target == 0) {
+        target = 1;
+    }
+    for (int i = 0; i < HID_INJECTOR_GAP_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            return i + 1;
+        }
+    }
+    return HID_INJECTOR_GAP_BUCKETS;
+}
+
+static void print_hist(const struct hid_injector_gap_hist *h) {
+    unsigned int peak = 0;
+
+    if (h->count == 0) {
+        printf("no key gaps recorded (nothing typed, or fewer than two keys per write)\n");
+        return;
+    }
+
+    printf("gaps=%llu min_ms=%.3f mean_ms=%.3f max_ms=%.3f\n", (unsigned long long)h->count,
+           h->min_us / 1000.0, (double)h->sum_us / h->count / 1000.0, h->max_us / 1000.0);
+    printf("p50<=%dms p90<=%dms p99<=%dms p99.9<=%dms\n", percentile_ms(h, 0.50), percentile_ms(h, 0.90),
+           percentile_ms(h, 0.99), percentile_ms(h, 0.999));
+
+    for (int i = 0; i < HID_INJECTOR_GAP_BUCKETS; i++) {
+        if (h->buckets[i] > peak) {
+            peak = h->buckets[i];
+        }
+    }
+    for (int i = 0; i < HID_INJECTOR_GAP_BUCKETS; i++) {
+        if (h->buckets[i] == 0) {
+            continue;
+        }
+        int bar = (int)((50ULL * h->buckets[i] + peak - 1) / peak);
+        printf("%3d%s ms %8u %.*s\n", i, i == HID_INJECTOR_GAP_BUCKETS - 1 ? "+" : " ", h->buckets[i], bar,
+               "##################################################");
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-d device] [-n keys | -w seconds] [-c cpu_hogs] [-i io_hogs] [-D io_dir]\n"
+            "  -n keys     type this many keys ourselves (default 500)\n"
+            "  -w seconds  don't type, measure whatever is injected meanwhile\n"
+            "  -c / -i     CPU busy-loop and fsync-writer threads to run during the measurement\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int nkeys = 500, watch_seconds = 0, cpu_hogs = 0, io_hogs = 0;
+    struct hid_injector_gap_hist hist;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:w:c:i:D:h")) != -1) {
+        switch (opt) {
+        case 'd': g_device_path = optarg; break;
+        case 'n': nkeys = atoi(optarg); break;
+        case 'w': watch_seconds = atoi(optarg); break;
+        case 'c': cpu_hogs = atoi(optarg); break;
+        case 'i': io_hogs = atoi(optarg); break;
+        case 'D': g_io_dir = optarg; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (nkeys < 2 || cpu_hogs < 0 || io_hogs < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int fd = open(g_device_path, O_RDWR);
+    if (fd < 0) {
+        perror("Failed to open injector device");
+        return 1;
+    }
+    int mode = HID_INJECTOR_MODE_KEYS;
+    if (ioctl(fd, HID_INJECTOR_IOC_SET_MODE, &mode) != 0 || ioctl(fd, HID_INJECTOR_IOC_GET_GAP_HIST, &hist) != 0) {
+        perror("Injector ioctl failed (module too old?)");
+        close(fd);
+        return 1;
+    }
+
+    int nthreads = cpu_hogs + io_hogs;
+    pthread_t *load = calloc(nthreads ? (size_t)nthreads : 1, sizeof(pthread_t));
+    struct hid_injector_key *keys = calloc((size_t)nkeys, sizeof(struct hid_injector_key));
+    if (load == NULL || keys == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_create(&load[i], NULL, i < cpu_hogs ? cpu_hog : io_hog, (void *)(size_t)i);
+    }
+    printf("load: %d cpu, %d io threads\n", cpu_hogs, io_hogs);
+
+    if (watch_seconds > 0) {
+        sleep((unsigned int)watch_seconds);
+    } else {
+        // lower-case letters only, so the host side sees nothing but harmless text.
+        for (int i = 0; i < nkeys; i++) {
+            keys[i].keycode = hid_injector_char_to_keycode((char)('a' + i % 26), &keys[i].modifier);
+        }
+        if (write(fd, keys, (size_t)nkeys * sizeof(struct hid_injector_key)) < 0) {
+            perror("Write to injector failed");
+        }
+    }
+
+    atomic_store(&g_stop_load, 1);
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(load[i], NULL);
+    }
+
+    if (ioctl(fd, HID_INJECTOR_IOC_GET_GAP_HIST, &hist) != 0) {
+        perror("Reading gap histogram failed");
+        close(fd);
+        return 1;
+    }
+    print_hist(&hist);
+
+    free(keys);
+    free(load);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,77 @@
+#!/bin/bash
+# run_ingest_bench.sh - load and soak benchmark for the daemon's HTTP staging path.
+# runs without the gadget: the daemon writes into a FIFO drained by cat, and GPIO is off (-g -1).
+# reports latency/throughput per scenario, the daemon's peak RSS and its allocator call counts.
+#
+# usage: bench/run_ingest_bench.sh   (from scripts/injector_daemon, after `make bench`)
+# tune with env vars, e.g. LARGE_SIZE=64M CONCURRENCY=16 bench/run_ingest_bench.sh
+set -euo pipefail
+
+cd "$(dirname "$0")/.."
+
+PORT=${PORT:-18080}
+CONCURRENCY=${CONCURRENCY:-8}
+SMALL_REQUESTS=${SMALL_REQUESTS:-2000}
+SMALL_SIZE=${SMALL_SIZE:-64-4k}
+LARGE_REQUESTS=${LARGE_REQUESTS:-16}
+LARGE_SIZE=${LARGE_SIZE:-1M-32M}
+LORIS_REQUESTS=${LORIS_REQUESTS:-32}
+LORIS_SIZE=${LORIS_SIZE:-16k}
+LORIS_CHUNK=${LORIS_CHUNK:-64}
+LORIS_DELAY_MS=${LORIS_DELAY_MS:-5}
+
+WORKDIR=$(mktemp -d)
+FIFO="$WORKDIR/device"
+DAEMON_PID=""
+DRAIN_PID=""
+
+cleanup() {
+    [ -n "$DAEMON_PID" ] && kill "$DAEMON_PID" 2>/dev/null || true
+    [ -n "$DRAIN_PID" ] && kill "$DRAIN_PID" 2>/dev/null || true
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+for f in ./injector_daemon ./bench/http_load ./bench/alloc_count.so; do
+    if [ ! -x "$f" ] && [ ! -f "$f" ]; then
+        echo "Missing $f, run 'make all bench' first." >&2
+        exit 1
+    fi
+done
+
+# the daemon opens the device at startup, so the FIFO needs a reader before it starts.
+mkfifo "$FIFO"
+cat "$FIFO" > /dev/null &
+DRAIN_PID=$!
+
+LD_PRELOAD=./bench/alloc_count.so ALLOC_COUNT_OUT="$WORKDIR/alloc.txt" \
+    ./injector_daemon -p "$PORT" -d "$FIFO" -g -1 > "$WORKDIR/daemon.log" 2>&1 &
+DAEMON_PID=$!
+
+# wait for the listener.
+for _ in $(seq 50); do
+    if ./bench/http_load -p "$PORT" -n 1 -c 1 -s 16 > /dev/null 2>&1; then
+        break
+    fi
+    sleep 0.1
+done
+
+run_scenario() {
+    local name=$1
+    shift
+    echo "== $name"
+    ./bench/http_load -p "$PORT" -c "$CONCURRENCY" "$@" || echo "($name: some requests failed)"
+}
+
+run_scenario "small payloads ($SMALL_SIZE)" -n "$SMALL_REQUESTS" -s "$SMALL_SIZE"
+run_scenario "large payloads ($LARGE_SIZE)" -n "$LARGE_REQUESTS" -s "$LARGE_SIZE"
+run_scenario "slow-loris ($LORIS_SIZE in ${LORIS_CHUNK}B chunks every ${LORIS_DELAY_MS}ms)" \
+    -n "$LORIS_REQUESTS" -s "$LORIS_SIZE" -k "$LORIS_CHUNK" -w "$LORIS_DELAY_MS"
+
+echo "== daemon"
+grep -E 'VmHWM|VmRSS' "/proc/$DAEMON_PID/status"
+
+kill -INT "$DAEMON_PID"
+wait "$DAEMON_PID" || true
+DAEMON_PID=""
+echo "allocations: $(cat "$WORKDIR/alloc.txt" 2>/dev/null || echo 'n/a')"
@@ -4,29 +4,255 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
-#include <poll.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <microhttpd.h>
+#include <zlib.h>
+#include <zstd.h>
 
-// program statics.
+#include "hid_injector.h"
+
+// program statics. the port, device and pin are defaults, see usage().
 #define PORT 8080
 #define KERNEL_DEVICE_PATH "/dev/hid_injector"
 #define GPIO_PIN 21
-#define BATCH_SIZE 20
+// keys per write(). payloads up to this size go out in one call, it stays well under the module's max_pending_keys.
+#define INJECT_CHUNK_KEYS 16384
 #define DEBOUNCE_DELAY_MS 250 // Debounce delay in milliseconds
+#define PROGRESS_INTERVAL_MS 200 // how often /progress pushes an update
+#define MAX_PAYLOAD_SLOTS 8 // slot 0 plus the library, see g_payloads
+#define MAX_TRIGGER_INPUTS 16
+#define INJECT_QUEUE_LEN 32
+// compressed uploads: what a body may expand to, and how much is inflated per step.
+#define MAX_DECOMPRESSED_SIZE (64 * 1024 * 1024)
+#define DECOMPRESS_WINDOW_SIZE 65536
+#define ZSTD_WINDOW_LOG_MAX 23 // refuse zstd frames that need more than 8 MiB of history
+
+// a payload translated into the kernel's keystroke format as soon as it is staged,
+// so a trigger only has to hand keys[] to write().
+struct StagedPayload {
+    struct hid_injector_key *keys;
+    size_t nkeys;
+    size_t source_len; // bytes received, for logging
+    int refs;          // the slot holding it plus any injection typing it, under g_payload_mutex
+};
 
 // --- Global State ---
-char *g_staged_payload = NULL;
+// slot 0 is the staged payload, typed once and then gone. slots 1.. are a library, kept until replaced.
+static struct StagedPayload *g_payloads[MAX_PAYLOAD_SLOTS];
 pthread_mutex_t g_payload_mutex = PTHREAD_MUTEX_INITIALIZER;
 static volatile int keep_running = 1;
 
+// command line overridable, e.g. to run against a stand-in device for benchmarks.
+static int g_port = PORT;
+static const char *g_device_path = KERNEL_DEVICE_PATH;
+
+// the injection thread's scheduling. this only shortens the wait from a trigger to its write() on a
+// busy board, the gaps between keys are paced by the kernel module's own workqueue.
+static int g_rt_priority = 0; // SCHED_FIFO priority, 0: normal scheduling
+static int g_worker_cpu = -1; // CPU to pin the injection thread to, -1: any
+static int g_lock_memory = 0; // mlockall(), so the staged keys and the thread stack don't fault in between trigger and write()
+
+// injection runs on its own thread so the trigger loop and the web server can still stop it.
+// triggers queue requests here and the injection thread types them one at a time, in trigger order.
+struct InjectRequest {
+    int input;            // index into g_inputs
+    int slot;
+    long long trigger_ns; // when the trigger fired, for trigger-to-first-key latency
+};
+
+pthread_mutex_t g_inject_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_inject_cond = PTHREAD_COND_INITIALIZER;
+static struct InjectRequest g_inject_queue[INJECT_QUEUE_LEN];
+static int g_inject_queued = 0;
+static struct InjectRequest g_inject_active = { -1, -1, 0 }; // input -1: nothing typing
+static atomic_int g_injecting = 0;
+static atomic_int g_abort_requested = 0;
+
+// the injection in progress, for /progress. atomics, so the injection thread never waits on a /metrics scrape.
+static atomic_size_t g_progress_total = 0;
+static atomic_size_t g_progress_done = 0;          // keys finished by earlier chunks
+static atomic_ullong g_progress_baseline = 0;     // kernel keys_typed when the current chunk started
+
 // --- Forward Declarations ---
 void* web_server_thread_func(void *arg);
-int perform_injection(void);
+void* injection_thread_func(void *arg);
+int perform_injection(int slot, long long trigger_ns);
+void request_injection(int input, int slot, long long trigger_ns, int toggle);
+void abort_injection(void);
+int http_trigger(int slot);
+struct StagedPayload *stage_payload(const char *data, size_t size);
+void install_payload(int slot, struct StagedPayload *payload);
+void release_payload(struct StagedPayload *payload);
+void free_staged_payload(struct StagedPayload *payload);
+int device_acquire(unsigned long long *keys_typed);
+void device_release(int failed, unsigned long long keys_typed);
+int device_ioctl(unsigned long request, void *arg);
+void device_refresh(void);
+
+// monotonic nanoseconds, the same clock the kernel module stamps its first key with.
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// --- Metrics ---
+// everything GET /metrics reports, in Prometheus text format.
+// updates happen once per upload or injection, so a single mutex is plenty.
+#define HIST_MAX_BUCKETS 12
+
+struct Histogram {
+    const double *bounds; // upper bounds, ascending, +Inf is implicit
+    size_t nbounds;
+    unsigned long long buckets[HIST_MAX_BUCKETS]; // per bucket, made cumulative when rendered
+    unsigned long long count;
+    double sum;
+};
+
+static const double k_latency_bounds[] = { 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 1 };
+static const double k_upload_bytes_bounds[] = { 1024, 16384, 262144, 1048576, 16777216, 67108864 };
+static const double k_upload_seconds_bounds[] = { 0.01, 0.1, 0.5, 1, 5, 30, 120 };
+#define BOUNDS(b) (b), (sizeof(b) / sizeof((b)[0]))
+
+struct Metrics {
+    unsigned long long injections_ok;
+    unsigned long long injections_aborted;
+    unsigned long long injections_failed;
+    unsigned long long keys_typed;
+    double last_chars_per_second;
+    struct Histogram trigger_to_first_key; // seconds
+    struct Histogram upload_bytes;
+    struct Histogram upload_seconds;
+    unsigned long long errors_device_open;
+    unsigned long long errors_device_write;
+    unsigned long long errors_http;
+};
+
+static struct Metrics g_metrics = {
+    .trigger_to_first_key = { BOUNDS(k_latency_bounds), {0}, 0, 0 },
+    .upload_bytes = { BOUNDS(k_upload_bytes_bounds), {0}, 0, 0 },
+    .upload_seconds = { BOUNDS(k_upload_seconds_bounds), {0}, 0, 0 },
+};
+pthread_mutex_t g_metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// call with g_metrics_mutex held.
+static void histogram_observe(struct Histogram *h, double value) {
+    size_t i = 0;
+    while (i < h->nbounds && value > h->bounds[i]) {
+        i++;
+    }
+    h->buckets[i]++;
+    h->count++;
+    h->sum += value;
+}
+
+static void histogram_render(FILE *out, const char *name, const char *help, const struct Histogram *h) {
+    unsigned long long cumulative = 0;
+
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (size_t i = 0; i < h->nbounds; i++) {
+        cumulative += h->buckets[i];
+        fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", name, h->bounds[i], cumulative);
+    }
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, h->count);
+    fprintf(out, "%s_sum %g\n%s_count %llu\n", name, h->sum, name, h->count);
+}
+
+// keys typed so far by this daemon's open file, straight from the kernel module.
+static int read_kernel_progress(struct hid_injector_progress *progress) {
+    return device_ioctl(HID_INJECTOR_IOC_GET_PROGRESS, progress);
+}
+
+// where the active injection is at. returns 0 when nothing is being typed.
+static int progress_snapshot(size_t *done, size_t *total) {
+    struct hid_injector_progress progress;
+
+    if (!atomic_load(&g_injecting)) {
+        return 0;
+    }
+
+    *done = atomic_load(&g_progress_done);
+    *total = atomic_load(&g_progress_total);
+    unsigned long long baseline = atomic_load(&g_progress_baseline);
+
+    if (read_kernel_progress(&progress) == 0 && progress.keys_typed > baseline) {
+        *done += progress.keys_typed - baseline;
+    }
+    if (*done > *total) {
+        *done = *total;
+    }
+    return 1;
+}
+
+// render all metrics into a malloc'd buffer.
+static char *render_metrics(size_t *size) {
+    char *buf = NULL;
+    FILE *out = open_memstream(&buf, size);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    size_t done = 0, total = 0;
+    int injecting = progress_snapshot(&done, &total);
+
+    size_t staged_keys[MAX_PAYLOAD_SLOTS];
+    int staged[MAX_PAYLOAD_SLOTS];
+    pthread_mutex_lock(&g_payload_mutex);
+    for (int i = 0; i < MAX_PAYLOAD_SLOTS; i++) {
+        staged[i] = g_payloads[i] != NULL;
+        staged_keys[i] = staged[i] ? g_payloads[i]->nkeys : 0;
+    }
+    pthread_mutex_unlock(&g_payload_mutex);
+
+    pthread_mutex_lock(&g_metrics_mutex);
+    fprintf(out, "# HELP hid_injector_injections_total Injections by outcome.\n# TYPE hid_injector_injections_total counter\n");
+    fprintf(out, "hid_injector_injections_total{result=\"success\"} %llu\n", g_metrics.injections_ok);
+    fprintf(out, "hid_injector_injections_total{result=\"aborted\"} %llu\n", g_metrics.injections_aborted);
+    fprintf(out, "hid_injector_injections_total{result=\"failed\"} %llu\n", g_metrics.injections_failed);
+    fprintf(out, "# HELP hid_injector_keys_typed_total Keystrokes typed by finished injections.\n# TYPE hid_injector_keys_typed_total counter\n");
+    fprintf(out, "hid_injector_keys_typed_total %llu\n", g_metrics.keys_typed);
+    fprintf(out, "# HELP hid_injector_chars_per_second Typing rate of the last injection.\n# TYPE hid_injector_chars_per_second gauge\n");
+    fprintf(out, "hid_injector_chars_per_second %g\n", g_metrics.last_chars_per_second);
+    histogram_render(out, "hid_injector_trigger_to_first_key_seconds",
+                     "Time from trigger to the first key report being queued.", &g_metrics.trigger_to_first_key);
+    histogram_render(out, "hid_injector_http_upload_bytes", "Size of staged payload uploads.", &g_metrics.upload_bytes);
+    histogram_render(out, "hid_injector_http_upload_seconds", "Time from first to last byte of an upload.", &g_metrics.upload_seconds);
+    fprintf(out, "# HELP hid_injector_errors_total Errors by kind.\n# TYPE hid_injector_errors_total counter\n");
+    fprintf(out, "hid_injector_errors_total{kind=\"device_open\"} %llu\n", g_metrics.errors_device_open);
+    fprintf(out, "hid_injector_errors_total{kind=\"device_write\"} %llu\n", g_metrics.errors_device_write);
+    fprintf(out, "hid_injector_errors_total{kind=\"http\"} %llu\n", g_metrics.errors_http);
+    pthread_mutex_unlock(&g_metrics_mutex);
+
+    fprintf(out, "# HELP hid_injector_injecting Whether an injection is in progress.\n# TYPE hid_injector_injecting gauge\n");
+    fprintf(out, "hid_injector_injecting %d\n", injecting);
+    fprintf(out, "# HELP hid_injector_injection_keys_done Keys typed so far by the active injection.\n# TYPE hid_injector_injection_keys_done gauge\n");
+    fprintf(out, "hid_injector_injection_keys_done %zu\n", done);
+    fprintf(out, "# HELP hid_injector_injection_keys_total Keys in the active injection.\n# TYPE hid_injector_injection_keys_total gauge\n");
+    fprintf(out, "hid_injector_injection_keys_total %zu\n", total);
+    fprintf(out, "# HELP hid_injector_staged_keys Keys in each payload slot waiting for a trigger.\n# TYPE hid_injector_staged_keys gauge\n");
+    for (int i = 0; i < MAX_PAYLOAD_SLOTS; i++) {
+        if (staged[i]) {
+            fprintf(out, "hid_injector_staged_keys{slot=\"%d\"} %zu\n", i, staged_keys[i]);
+        }
+    }
+
+    fclose(out);
+    return buf;
+}
 
 // --- GPIO & System Setup ---
 int initialize_gpio(int pin) {
@@ -64,21 +290,255 @@ void cleanup_gpio(int pin) {
     }
 }
 
+enum UploadEncoding {
+    ENCODING_IDENTITY,
+    ENCODING_GZIP,
+    ENCODING_ZSTD,
+};
+
 // simple web server state struct
 struct PostRequestState {
     char *data;
     size_t size;
+    size_t received;    // bytes on the wire, before any decompression
+    long long start_ns; // first call for this request, for the upload time metric
+
+    // Content-Encoding of the body. compressed bodies are inflated chunk by chunk as they arrive,
+    // so only the decoder state and one window exist besides the decompressed text.
+    enum UploadEncoding encoding;
+    z_stream gzip;
+    ZSTD_DStream *zstd;
+    int stream_ended;     // the compressed stream was complete
+    unsigned int status;  // non-zero once the upload is rejected, the rest of the body is discarded
 };
 
+// state of one /progress stream.
+struct ProgressStream {
+    int sent_any;
+};
+
+// server-sent events: one "data:" line per PROGRESS_INTERVAL_MS while the client stays connected.
+// blocking here is fine, every connection has its own thread.
+static ssize_t progress_reader(void *cls, uint64_t pos, char *buf, size_t max) {
+    struct ProgressStream *stream = cls;
+    (void)pos;
+
+    if (!keep_running) {
+        return MHD_CONTENT_READER_END_OF_STREAM;
+    }
+    if (stream->sent_any) {
+        usleep(PROGRESS_INTERVAL_MS * 1000);
+    }
+    stream->sent_any = 1;
+
+    size_t done = 0, total = 0;
+    int injecting = progress_snapshot(&done, &total);
+    int n = snprintf(buf, max, "data: {\"injecting\":%d,\"done\":%zu,\"total\":%zu}\n\n", injecting, done, total);
+    if (n < 0 || (size_t)n >= max) {
+        return MHD_CONTENT_READER_END_WITH_ERROR;
+    }
+    return n;
+}
+
+// grows the staging buffer by one chunk of (decompressed) text.
+static int upload_append(struct PostRequestState *request_state, const char *data, size_t size) {
+    if (size == 0) {
+        return 0; // realloc() of an empty buffer to size 0 would free it
+    }
+    char *new_data = realloc(request_state->data, request_state->size + size);
+    if (new_data == NULL) {
+        return -1;
+    }
+    request_state->data = new_data;
+    memcpy(&request_state->data[request_state->size], data, size);
+    request_state->size += size;
+    return 0;
+}
+
+// same as upload_append, with the MAX_DECOMPRESSED_SIZE check. returns 0 or the HTTP status to reject with.
+static unsigned int upload_append_decompressed(struct PostRequestState *request_state, const char *data, size_t size) {
+    if (request_state->size + size > MAX_DECOMPRESSED_SIZE) {
+        return MHD_HTTP_PAYLOAD_TOO_LARGE;
+    }
+    return upload_append(request_state, data, size) == 0 ? 0 : MHD_HTTP_INTERNAL_SERVER_ERROR;
+}
+
+// set up the decoder for the request's Content-Encoding. returns 0 or the HTTP status to reject with.
+static unsigned int upload_init_encoding(struct PostRequestState *request_state, struct MHD_Connection *connection) {
+    const char *encoding = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_CONTENT_ENCODING);
+
+    if (encoding == NULL || strcasecmp(encoding, "identity") == 0) {
+        request_state->encoding = ENCODING_IDENTITY;
+    } else if (strcasecmp(encoding, "gzip") == 0 || strcasecmp(encoding, "x-gzip") == 0) {
+        request_state->encoding = ENCODING_GZIP;
+        // 16 + MAX_WBITS: gzip framing only, with zlib's fixed 32 KiB window.
+        if (inflateInit2(&request_state->gzip, 16 + MAX_WBITS) != Z_OK) {
+            return MHD_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    } else if (strcasecmp(encoding, "zstd") == 0) {
+        request_state->encoding = ENCODING_ZSTD;
+        request_state->zstd = ZSTD_createDStream();
+        if (request_state->zstd == NULL) {
+            return MHD_HTTP_INTERNAL_SERVER_ERROR;
+        }
+        ZSTD_DCtx_setParameter(request_state->zstd, ZSTD_d_windowLogMax, ZSTD_WINDOW_LOG_MAX);
+    } else {
+        return MHD_HTTP_UNSUPPORTED_MEDIA_TYPE;
+    }
+    return 0;
+}
+
+// decompress one chunk of the body into the staging buffer, DECOMPRESS_WINDOW_SIZE at a time.
+// returns 0 or the HTTP status to reject with.
+static unsigned int upload_decompress(struct PostRequestState *request_state, const char *data, size_t size) {
+    char window[DECOMPRESS_WINDOW_SIZE];
+    unsigned int status;
+
+    if (request_state->encoding == ENCODING_GZIP) {
+        z_stream *gzip = &request_state->gzip;
+        gzip->next_in = (Bytef *)data;
+        gzip->avail_in = (uInt)size;
+
+        do {
+            gzip->next_out = (Bytef *)window;
+            gzip->avail_out = sizeof(window);
+            int ret = inflate(gzip, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                return MHD_HTTP_BAD_REQUEST;
+            }
+
+            size_t produced = sizeof(window) - gzip->avail_out;
+            if ((status = upload_append_decompressed(request_state, window, produced)) != 0) {
+                return status;
+            }
+
+            request_state->stream_ended = 0;
+            if (ret == Z_STREAM_END) {
+                // a body may hold several gzip members back to back.
+                request_state->stream_ended = 1;
+                if (gzip->avail_in > 0 && inflateReset(gzip) != Z_OK) {
+                    return MHD_HTTP_BAD_REQUEST;
+                }
+            } else if (ret == Z_BUF_ERROR && produced == 0) {
+                break; // needs more input
+            }
+        } while (gzip->avail_in > 0 || gzip->avail_out == 0);
+        return 0;
+    }
+
+    ZSTD_inBuffer in = { data, size, 0 };
+    ZSTD_outBuffer out;
+    do {
+        out = (ZSTD_outBuffer){ window, sizeof(window), 0 };
+        size_t ret = ZSTD_decompressStream(request_state->zstd, &out, &in);
+        if (ZSTD_isError(ret)) {
+            return MHD_HTTP_BAD_REQUEST;
+        }
+        if ((status = upload_append_decompressed(request_state, window, out.pos)) != 0) {
+            return status;
+        }
+        request_state->stream_ended = (ret == 0);
+    } while (in.pos < in.size || out.pos == out.size);
+    return 0;
+}
+
+static void free_request_state(struct PostRequestState *request_state) {
+    if (request_state == NULL) {
+        return;
+    }
+    if (request_state->encoding == ENCODING_GZIP) {
+        inflateEnd(&request_state->gzip);
+    }
+    ZSTD_freeDStream(request_state->zstd);
+    free(request_state->data);
+    free(request_state);
+}
+
+// called by libmicrohttpd when a request ends, also for clients that disconnect mid-upload.
+static void request_completed(void *cls, struct MHD_Connection *connection, void **con_cls,
+                              enum MHD_RequestTerminationCode toe) {
+    (void)cls; (void)connection; (void)toe;
+
+    // --- Clean up the connection state ---
+    free_request_state(*con_cls);
+    *con_cls = NULL;
+}
+
+// "/trigger" or "/trigger/3" style URLs. returns 0 if url isn't under prefix, otherwise 1 with
+// *slot set to the slot number (0 when none is given), or -1 if it doesn't name a valid slot.
+static int parse_slot_url(const char *url, const char *prefix, int *slot) {
+    size_t len = strlen(prefix);
+    if (strncmp(url, prefix, len) != 0) {
+        return 0;
+    }
+    url += len;
+    if (*url == '\0') {
+        *slot = 0;
+        return 1;
+    }
+    if (*url != '/') {
+        return 0;
+    }
+
+    char *end;
+    long n = strtol(url + 1, &end, 10);
+    *slot = (end != url + 1 && *end == '\0' && n >= 0 && n < MAX_PAYLOAD_SLOTS) ? (int)n : -1;
+    return 1;
+}
+
+static enum MHD_Result send_page(struct MHD_Connection *connection, unsigned int status, const char *page) {
+    struct MHD_Response *response = MHD_create_response_from_buffer(strlen(page), (void *)page, MHD_RESPMEM_PERSISTENT);
+    enum MHD_Result ret = MHD_queue_response(connection, status, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+// GET /metrics and GET /progress, nothing else is readable.
+static enum MHD_Result get_handler(struct MHD_Connection *connection, const char *url) {
+    struct MHD_Response *response;
+    enum MHD_Result ret;
+
+    if (0 == strcmp(url, "/metrics")) {
+        size_t size = 0;
+        char *body = render_metrics(&size);
+        if (body == NULL) {
+            return MHD_NO;
+        }
+        response = MHD_create_response_from_buffer(size, body, MHD_RESPMEM_MUST_FREE);
+        MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/plain; version=0.0.4");
+    } else if (0 == strcmp(url, "/progress")) {
+        struct ProgressStream *stream = calloc(1, sizeof(struct ProgressStream));
+        if (stream == NULL) {
+            return MHD_NO;
+        }
+        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 256, &progress_reader, stream, &free);
+        MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/event-stream");
+        MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-cache");
+    } else {
+        return send_page(connection, MHD_HTTP_NOT_FOUND, "<html><body>Not found.</body></html>");
+    }
+
+    if (response == NULL) {
+        return MHD_NO;
+    }
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
 // Web server component.
 enum MHD_Result post_handler(void *cls, struct MHD_Connection *connection,
                           const char *url, const char *method,
                           const char *version, const char *upload_data,
                           size_t *upload_data_size, void **con_cls) {
     // Silence unused parameter warnings
-    (void)cls; (void)url; (void)version;
+    (void)cls; (void)version;
+
+    if (0 == strcmp(method, "GET")) {
+        return get_handler(connection, url);
+    }
 
-    // We only accept POST requests
+    // Everything else has to be a POST
     if (0 != strcmp(method, "POST")) {
         return MHD_NO;
     }
@@ -86,12 +546,16 @@ enum MHD_Result post_handler(void *cls, struct MHD_Connection *connection,
     // On the first call for a connection, set up our state structure
     // post_handler gets called multiple times, with chunks of data, this allows it to have basic protection against DOS attacks.
     if (*con_cls == NULL) {
-        struct PostRequestState *request_state = malloc(sizeof(struct PostRequestState));
+        struct PostRequestState *request_state = calloc(1, sizeof(struct PostRequestState));
         if (request_state == NULL) {
+            pthread_mutex_lock(&g_metrics_mutex);
+            g_metrics.errors_http++;
+            pthread_mutex_unlock(&g_metrics_mutex);
             return MHD_NO; // Internal server error
         }
-        request_state->data = NULL;
-        request_state->size = 0;
+        request_state->start_ns = now_ns();
+        // a bad encoding is answered once the body is in, replying early confuses most clients.
+        request_state->status = upload_init_encoding(request_state, connection);
         *con_cls = (void *)request_state;
         return MHD_YES;
     }
@@ -100,72 +564,128 @@ enum MHD_Result post_handler(void *cls, struct MHD_Connection *connection,
 
     // If libmicrohttpd is giving us data, accumulate it.
     if (*upload_data_size > 0) {
-        // Reallocate buffer to hold the new chunk of data
-        char *new_data = realloc(request_state->data, request_state->size + *upload_data_size);
+        request_state->received += *upload_data_size;
 
-        // if the signal has not been sent to terminate, and a null is received, this is improper, handle it.
-        if (new_data == NULL) {
+        if (request_state->status != 0) {
+            // already rejected, drop the rest of the body.
+        } else if (request_state->encoding != ENCODING_IDENTITY) {
+            request_state->status = upload_decompress(request_state, upload_data, *upload_data_size);
+        } else if (upload_append(request_state, upload_data, *upload_data_size) != 0) {
+            // if the signal has not been sent to terminate, and a null is received, this is improper, handle it.
+            pthread_mutex_lock(&g_metrics_mutex);
+            g_metrics.errors_http++;
+            pthread_mutex_unlock(&g_metrics_mutex);
             return MHD_NO;
         }
-        request_state->data = new_data;
-
-        // Copy the new data chunk to the end of our buffer
-        memcpy(&request_state->data[request_state->size], upload_data, *upload_data_size);
-        request_state->size += *upload_data_size;
 
         // Tell libmicrohttpd that we have processed this chunk
         *upload_data_size = 0;
         return MHD_YES;
     }
 
-    // termination signal is when request state data is null. handle it and give a response.
-    if (request_state->data != NULL) {
-        pthread_mutex_lock(&g_payload_mutex);
-        
-        // Free any previously staged payload
-        free(g_staged_payload);
-        
-        // copy the staged data over using strndup (safe).
-        g_staged_payload = strndup(request_state->data, request_state->size);
-        
-        pthread_mutex_unlock(&g_payload_mutex);
+    const char *page = "<html><body>Payload staged for next injection.</body></html>";
+
+    // a truncated compressed body is as bad as a corrupt one.
+    if (request_state->status == 0 && request_state->encoding != ENCODING_IDENTITY &&
+        request_state->received > 0 && !request_state->stream_ended) {
+        request_state->status = MHD_HTTP_BAD_REQUEST;
+    }
+
+    if (request_state->status != 0) {
+        pthread_mutex_lock(&g_metrics_mutex);
+        g_metrics.errors_http++;
+        pthread_mutex_unlock(&g_metrics_mutex);
+
+        switch (request_state->status) {
+        case MHD_HTTP_UNSUPPORTED_MEDIA_TYPE:
+            page = "<html><body>Unsupported Content-Encoding, use gzip or zstd.</body></html>";
+            break;
+        case MHD_HTTP_PAYLOAD_TOO_LARGE:
+            page = "<html><body>Payload expands past the size limit.</body></html>";
+            break;
+        case MHD_HTTP_BAD_REQUEST:
+            page = "<html><body>Corrupt or truncated compressed payload.</body></html>";
+            break;
+        default:
+            page = "<html><body>Out of memory.</body></html>";
+            break;
+        }
+        printf("Web server rejected an upload (%zu bytes received, status %u).\n", request_state->received,
+               request_state->status);
+        return send_page(connection, request_state->status, page);
+    }
+
+    int slot = 0;
 
-        if (g_staged_payload != NULL) {
-             printf("Web server received new payload (%zu bytes): %s\n", 
-                    strlen(g_staged_payload), g_staged_payload);
+    // the abort endpoint ignores any body, it stops whatever is typing and everything queued behind it.
+    if (0 == strcmp(url, "/abort")) {
+        pthread_mutex_lock(&g_inject_mutex);
+        g_inject_queued = 0;
+        abort_injection();
+        pthread_mutex_unlock(&g_inject_mutex);
+        page = "<html><body>Injection aborted.</body></html>";
+    }
+    // a trigger like any button, the main loop handles it. also ignores any body.
+    else if (parse_slot_url(url, "/trigger", &slot)) {
+        if (slot < 0 || http_trigger(slot) != 0) {
+            return send_page(connection, MHD_HTTP_NOT_FOUND, "<html><body>No such payload slot.</body></html>");
         }
+        page = "<html><body>Injection triggered.</body></html>";
     }
+    // POST /payload/N fills library slot N, any other URL stages slot 0.
+    else if (parse_slot_url(url, "/payload", &slot) && slot < 0) {
+        return send_page(connection, MHD_HTTP_NOT_FOUND, "<html><body>No such payload slot.</body></html>");
+    }
+    // termination signal is when request state data is null. handle it and give a response.
+    else if (request_state->data != NULL) {
+        pthread_mutex_lock(&g_metrics_mutex);
+        histogram_observe(&g_metrics.upload_bytes, (double)request_state->received);
+        histogram_observe(&g_metrics.upload_seconds, (now_ns() - request_state->start_ns) / 1e9);
+        pthread_mutex_unlock(&g_metrics_mutex);
 
-    // finally, send the response.
-    const char *page = "<html><body>Payload staged for next injection.</body></html>";
-    struct MHD_Response *response = MHD_create_response_from_buffer(strlen(page), (void *)page, MHD_RESPMEM_PERSISTENT);
-    int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-    MHD_destroy_response(response);
+        // translate now, while nobody is waiting on it, the trigger only has to write().
+        struct StagedPayload *staged = stage_payload(request_state->data, request_state->size);
 
-    // --- Clean up the connection state ---
-    if (request_state != NULL) {
-        free(request_state->data);
-        free(request_state);
+        if (staged != NULL) {
+            size_t nkeys = staged->nkeys;
+
+            install_payload(slot, staged);
+
+            printf("Web server staged a new payload in slot %d (%zu bytes, %zu received, %zu keys).\n",
+                   slot, request_state->size, request_state->received, nkeys);
+        }
+
+        // a good moment to make sure the device is open, before anyone presses the button.
+        device_refresh();
     }
-    *con_cls = NULL;
 
-    return ret;
+    // finally, send the response. request_completed() frees the state.
+    return send_page(connection, MHD_HTTP_OK, page);
 }
 
 // simple function that starts the web server.
 void* web_server_thread_func(void *arg) {
     (void)arg;
 
-    struct MHD_Daemon *daemon = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY, PORT, NULL, NULL,
-                                                &post_handler, NULL, MHD_OPTION_END);
+    // a thread per connection, so a long-lived /progress stream never holds up an upload.
+    struct MHD_Daemon *daemon = MHD_start_daemon(MHD_USE_SELECT_INTERNALLY | MHD_USE_THREAD_PER_CONNECTION, g_port, NULL, NULL,
+                                                &post_handler, NULL,
+                                                MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+                                                MHD_OPTION_END);
     if (NULL == daemon) {
         fprintf(stderr, "Failed to start web server daemon.\n");
         return NULL;
     }
-    printf("Web server started on port %d.\n", PORT);
+    printf("Web server started on port %d.\n", g_port);
 
     while (keep_running) {
         sleep(1);
+        // notice a rebound gadget here rather than on the next trigger.
+        // main() cancels this thread on shutdown, don't let that happen while holding the device mutex.
+        int old_state;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old_state);
+        device_refresh();
+        pthread_setcancelstate(old_state, NULL);
     }
 
     MHD_stop_daemon(daemon);
@@ -173,57 +693,427 @@ void* web_server_thread_func(void *arg) {
     return NULL;
 }
 
+// --- Kernel Device ---
+// the device stays open between injections in keystroke mode, so a trigger doesn't pay for open() and ioctl().
+static int g_device_fd = -1;
+static dev_t g_device_rdev;
+static ino_t g_device_ino;
+static int g_device_users = 0;  // injections writing to g_device_fd right now
+static int g_device_stale = 0;  // close g_device_fd once the last of them is done with it
+static unsigned long long g_device_keys; // the kernel's keys_typed for g_device_fd after the last write
+pthread_mutex_t g_device_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// only called with no users, an injection never sees its descriptor number reused under it.
+static void device_close_locked(void) {
+    if (g_device_fd >= 0) {
+        close(g_device_fd);
+        g_device_fd = -1;
+    }
+    g_device_stale = 0;
+}
+
+static int device_open_locked(void) {
+    struct stat st;
+    struct hid_injector_progress progress;
+    int mode = HID_INJECTOR_MODE_KEYS;
+
+    int fd = open(g_device_path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    // we translate payloads ourselves, see stage_payload().
+    // a FIFO or plain file is a benchmark stand-in and takes anything. a character device that
+    // won't switch modes is an old module or one we can't talk to, and it would type our keys as text.
+    if (ioctl(fd, HID_INJECTOR_IOC_SET_MODE, &mode) < 0 && (errno != ENOTTY || S_ISCHR(st.st_mode))) {
+        perror("Kernel device does not accept keystroke mode");
+        close(fd);
+        return -1;
+    }
+
+    // injections advance this by what each write() reports, /progress never needs a fresh baseline.
+    if (ioctl(fd, HID_INJECTOR_IOC_GET_PROGRESS, &progress) < 0) {
+        progress.keys_typed = 0;
+    }
+
+    g_device_fd = fd;
+    g_device_rdev = st.st_rdev;
+    g_device_ino = st.st_ino;
+    g_device_keys = progress.keys_typed;
+    printf("Kernel device %s opened.\n", g_device_path);
+    return fd;
+}
+
+// returns the open device for an injection, opening it first if needed, and the kernel's
+// keys_typed count for it. no syscalls when it is already open. the descriptor stays open
+// until the matching device_release().
+int device_acquire(unsigned long long *keys_typed) {
+    pthread_mutex_lock(&g_device_mutex);
+    int fd = g_device_fd >= 0 ? g_device_fd : device_open_locked();
+    if (fd >= 0) {
+        g_device_users++;
+        *keys_typed = g_device_keys;
+    }
+    pthread_mutex_unlock(&g_device_mutex);
+    return fd;
+}
+
+// done with the descriptor from device_acquire(). failed says a write just proved it dead,
+// keys_typed is the kernel's count for it after the injection.
+void device_release(int failed, unsigned long long keys_typed) {
+    pthread_mutex_lock(&g_device_mutex);
+    g_device_users--;
+    g_device_keys = keys_typed;
+    if (failed) {
+        g_device_stale = 1;
+    }
+    if (g_device_stale && g_device_users == 0) {
+        device_close_locked();
+    }
+    pthread_mutex_unlock(&g_device_mutex);
+}
+
+// an ioctl on the open device, for callers that don't inject. fails with ENODEV when it isn't open.
+int device_ioctl(unsigned long request, void *arg) {
+    pthread_mutex_lock(&g_device_mutex);
+    int ret = -1;
+    if (g_device_fd >= 0) {
+        ret = ioctl(g_device_fd, request, arg);
+    } else {
+        errno = ENODEV;
+    }
+    pthread_mutex_unlock(&g_device_mutex);
+    return ret;
+}
+
+// if the gadget was rebound, /dev/hid_injector is a new node and our descriptor is stale. reopen it.
+// kept off the trigger path: runs at staging time and once a second from the web server thread.
+void device_refresh(void) {
+    struct stat st;
+
+    pthread_mutex_lock(&g_device_mutex);
+    if (g_device_fd >= 0 && !g_device_stale) {
+        if (stat(g_device_path, &st) != 0 || st.st_rdev != g_device_rdev || st.st_ino != g_device_ino) {
+            printf("Kernel device %s changed, reopening.\n", g_device_path);
+            g_device_stale = 1;
+        }
+    }
+    // an injection still writing keeps the old descriptor, device_release() closes it after.
+    if (g_device_stale && g_device_users == 0) {
+        device_close_locked();
+    }
+    if (g_device_fd < 0) {
+        device_open_locked();
+    }
+    pthread_mutex_unlock(&g_device_mutex);
+}
+
 // --- Injection Component ---
-int perform_injection(void) {
-    printf("inject!!\n");
-    char *payload_to_inject = NULL;
+
+// translate a received payload into the keystrokes the kernel module types as-is.
+// characters with no key on a US layout are dropped here instead of at injection time.
+struct StagedPayload *stage_payload(const char *data, size_t size) {
+    struct StagedPayload *payload = malloc(sizeof(struct StagedPayload));
+    if (payload == NULL) {
+        return NULL;
+    }
+
+    payload->keys = malloc((size ? size : 1) * sizeof(struct hid_injector_key));
+    if (payload->keys == NULL) {
+        free(payload);
+        return NULL;
+    }
+    payload->nkeys = 0;
+    payload->source_len = size;
+    payload->refs = 1;
+
+    size_t skipped = 0;
+    for (size_t i = 0; i < size; i++) {
+        __u8 modifier = 0;
+        __u8 keycode = hid_injector_char_to_keycode(data[i], &modifier);
+
+        if (keycode == 0) {
+            skipped++;
+            continue;
+        }
+        payload->keys[payload->nkeys].modifier = modifier;
+        payload->keys[payload->nkeys].keycode = keycode;
+        payload->nkeys++;
+    }
+
+    if (skipped > 0) {
+        printf("Staging: skipped %zu unsupported characters.\n", skipped);
+    }
+    return payload;
+}
+
+void free_staged_payload(struct StagedPayload *payload) {
+    if (payload == NULL) {
+        return;
+    }
+    free(payload->keys);
+    free(payload);
+}
+
+// drop a reference to a payload, the last one frees it. staged payloads are never modified,
+// so an injection can keep typing one while the web server replaces its slot.
+void release_payload(struct StagedPayload *payload) {
+    if (payload == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&g_payload_mutex);
+    int last = --payload->refs == 0;
+    pthread_mutex_unlock(&g_payload_mutex);
+
+    if (last) {
+        free_staged_payload(payload);
+    }
+}
+
+// put a freshly staged payload in a slot, replacing whatever was there.
+void install_payload(int slot, struct StagedPayload *payload) {
+    pthread_mutex_lock(&g_payload_mutex);
+    struct StagedPayload *old = g_payloads[slot];
+    g_payloads[slot] = payload;
+    pthread_mutex_unlock(&g_payload_mutex);
+
+    release_payload(old);
+}
+
+// queue an injection of a payload slot for a trigger input. never blocks the caller.
+// if that input already has the slot queued or typing, a toggling input (a button) cancels it,
+// anything else leaves it be so a repeating timer can't pile up requests.
+void request_injection(int input, int slot, long long trigger_ns, int toggle) {
+    pthread_mutex_lock(&g_inject_mutex);
+
+    int queued = -1;
+    for (int i = 0; i < g_inject_queued; i++) {
+        if (g_inject_queue[i].input == input && g_inject_queue[i].slot == slot) {
+            queued = i;
+        }
+    }
+
+    if (g_inject_active.input == input && g_inject_active.slot == slot) {
+        // still under the lock, so this can't stop an injection queued by someone else.
+        if (toggle) {
+            abort_injection();
+        }
+    } else if (queued >= 0) {
+        if (toggle) {
+            g_inject_queued--;
+            memmove(&g_inject_queue[queued], &g_inject_queue[queued + 1],
+                    (g_inject_queued - queued) * sizeof(struct InjectRequest));
+            printf("Queued injection of slot %d cancelled.\n", slot);
+        }
+    } else if (g_inject_queued == INJECT_QUEUE_LEN) {
+        fprintf(stderr, "Injection queue full, dropped a trigger for slot %d.\n", slot);
+    } else {
+        g_inject_queue[g_inject_queued++] = (struct InjectRequest){ input, slot, trigger_ns };
+        pthread_cond_signal(&g_inject_cond);
+    }
+
+    pthread_mutex_unlock(&g_inject_mutex);
+}
+
+// stop the current injection. the kernel module drops what our descriptor has queued, pulls back
+// the reports still in flight and releases all keys, so this takes effect within one report interval.
+// other writers of the device (gpio-injector.sh, say) keep their injections.
+// the kernel keeps refusing our writes until the injection thread dequeues the next request,
+// so a write() already on its way in is stopped too. call with g_inject_mutex held.
+void abort_injection(void) {
+    atomic_store(&g_abort_requested, 1);
+
+    if (device_ioctl(HID_INJECTOR_IOC_ABORT, NULL) < 0) {
+        perror("Abort ioctl failed");
+    }
+    printf("--- Abort requested. ---\n");
+}
+
+// applied by the injection thread to itself. failures (usually missing privileges) are reported
+// and injection carries on with normal scheduling.
+static void configure_injection_thread(void) {
+    if (g_worker_cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(g_worker_cpu, &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err != 0) {
+            fprintf(stderr, "Failed to pin injection thread to CPU %d: %s\n", g_worker_cpu, strerror(err));
+        }
+    }
+
+    if (g_rt_priority > 0) {
+        struct sched_param param = { .sched_priority = g_rt_priority };
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            fprintf(stderr, "Failed to set SCHED_FIFO priority %d for injection: %s\n", g_rt_priority, strerror(err));
+        } else {
+            printf("Injection thread running SCHED_FIFO, priority %d.\n", g_rt_priority);
+        }
+    }
+}
+
+void* injection_thread_func(void *arg) {
+    (void)arg;
+
+    configure_injection_thread();
+
+    pthread_mutex_lock(&g_inject_mutex);
+    while (keep_running) {
+        if (g_inject_queued == 0) {
+            pthread_cond_wait(&g_inject_cond, &g_inject_mutex);
+            continue;
+        }
+        struct InjectRequest request = g_inject_queue[0];
+        g_inject_queued--;
+        memmove(&g_inject_queue[0], &g_inject_queue[1], g_inject_queued * sizeof(struct InjectRequest));
+        g_inject_active = request;
+
+        // an abort only applies to the injection it was meant for. cleared under the lock,
+        // so a stop press that already saw this injection as active is never lost.
+        // the kernel side only needs re-arming after an abort, the usual trigger pays no ioctl for it.
+        // with the device closed there is nothing to re-arm, the next open starts out armed.
+        if (atomic_exchange(&g_abort_requested, 0) && device_ioctl(HID_INJECTOR_IOC_RESUME, NULL) < 0 &&
+            errno != ENODEV) {
+            perror("Resume ioctl failed");
+        }
+        pthread_mutex_unlock(&g_inject_mutex);
+
+        atomic_store(&g_injecting, 1);
+        perform_injection(request.slot, request.trigger_ns);
+        atomic_store(&g_injecting, 0);
+
+        pthread_mutex_lock(&g_inject_mutex);
+        g_inject_active.input = -1;
+    }
+    pthread_mutex_unlock(&g_inject_mutex);
+    return NULL;
+}
+
+int perform_injection(int slot, long long trigger_ns) {
+    struct StagedPayload *payload_to_inject = NULL;
+    struct hid_injector_progress progress;
     int ret = 0;
 
     // keep a mutex lock on the resource, we signal to the rest of the program that we are injecting.
     pthread_mutex_lock(&g_payload_mutex);
-    if (g_staged_payload != NULL) {
-        payload_to_inject = g_staged_payload;
-        g_staged_payload = NULL;
+    payload_to_inject = g_payloads[slot];
+    if (payload_to_inject != NULL) {
+        if (slot == 0) {
+            g_payloads[0] = NULL; // typed once, the slot's reference becomes ours
+        } else {
+            payload_to_inject->refs++;
+        }
     }
     pthread_mutex_unlock(&g_payload_mutex);
 
     if (payload_to_inject == NULL) {
-        printf("Injection triggered, but no payload is staged.\n");
+        printf("Injection triggered, but payload slot %d is empty.\n", slot);
         return 0;
     }
 
-    printf("--- Starting injection of payload: \"%s\" ---\n", payload_to_inject);
-    
-    int fd = open(KERNEL_DEVICE_PATH, O_WRONLY);
+    unsigned long long kernel_keys = 0;
+    int fd = device_acquire(&kernel_keys);
     if (fd < 0) {
         perror("Failed to open kernel device for injection");
-        free(payload_to_inject);
+        release_payload(payload_to_inject);
+        pthread_mutex_lock(&g_metrics_mutex);
+        g_metrics.errors_device_open++;
+        g_metrics.injections_failed++;
+        pthread_mutex_unlock(&g_metrics_mutex);
         return -1;
     }
 
-    size_t total_len = strlen(payload_to_inject);
+    size_t total_keys = payload_to_inject->nkeys;
     size_t offset = 0;
+    int reopened = 0;
+    long long first_key_ns = 0;
+
+    atomic_store(&g_progress_total, total_keys);
+
+    while (offset < total_keys) {
+        // an abort may land between two chunks, don't start the next one.
+        if (atomic_load(&g_abort_requested)) {
+            ret = -1;
+            break;
+        }
+
+        // the kernel's per-file counter past kernel_keys tells /progress how far into this chunk we are.
+        atomic_store(&g_progress_baseline, kernel_keys);
+        atomic_store(&g_progress_done, offset);
+
+        // the payload is already in the kernel's format, usually this is the only write.
+        size_t batch = (total_keys - offset > INJECT_CHUNK_KEYS) ? INJECT_CHUNK_KEYS : (total_keys - offset);
+        ssize_t written = write(fd, payload_to_inject->keys + offset, batch * sizeof(struct hid_injector_key));
 
-    while (offset < total_len) {
-        // select the batch size based on ternary, do we have plenty left or less than batch size left to inject?
-        size_t batch = (total_len - offset > BATCH_SIZE) ? BATCH_SIZE : (total_len - offset);
-        // perform the write.
-        ssize_t written = write(fd, payload_to_inject + offset, batch);
-        
-        // error check.
+        // error check. ECANCELED is the kernel telling us an abort stopped this chunk.
+        if (written < 0 && errno == ECANCELED) {
+            ret = -1;
+            break;
+        }
+        // the gadget went away under us, reopen once and carry on with the same chunk.
+        if (written < 0 && !reopened && (errno == ENODEV || errno == ENXIO || errno == EBADF || errno == EIO)) {
+            int saved_errno = errno;
+            reopened = 1;
+            device_release(1, kernel_keys);
+            fd = device_acquire(&kernel_keys);
+            if (fd >= 0) {
+                continue;
+            }
+            errno = saved_errno;
+        }
         if (written < 0) {
             perror("Kernel module write error during injection");
+            pthread_mutex_lock(&g_metrics_mutex);
+            g_metrics.errors_device_write++;
+            pthread_mutex_unlock(&g_metrics_mutex);
             ret = -1;
             break;
         }
-        offset += written;
+        offset += (size_t)written / sizeof(struct hid_injector_key);
+        kernel_keys += (size_t)written / sizeof(struct hid_injector_key);
+
+        // the first chunk carries the first key, the kernel stamped when it went out.
+        if (first_key_ns == 0 && ioctl(fd, HID_INJECTOR_IOC_GET_PROGRESS, &progress) == 0) {
+            first_key_ns = (long long)progress.first_key_ns;
+        }
+    }
+
+    if (fd >= 0) {
+        // a chunk cut short typed an unknown part of itself, ask the kernel now the injection is over.
+        if (ret != 0 && ioctl(fd, HID_INJECTOR_IOC_GET_PROGRESS, &progress) == 0) {
+            kernel_keys = progress.keys_typed;
+        }
+        device_release(0, kernel_keys);
     }
+    release_payload(payload_to_inject);
 
-    close(fd);
-    free(payload_to_inject);
+    // for an aborted injection we count what we know finished, the chunk that was cut short is not included.
+    long long end_ns = now_ns();
+    pthread_mutex_lock(&g_metrics_mutex);
+    g_metrics.keys_typed += offset;
+    if (first_key_ns > 0 && first_key_ns >= trigger_ns) {
+        histogram_observe(&g_metrics.trigger_to_first_key, (first_key_ns - trigger_ns) / 1e9);
+        if (end_ns > first_key_ns && offset > 0) {
+            g_metrics.last_chars_per_second = offset / ((end_ns - first_key_ns) / 1e9);
+        }
+    }
+    if (ret == 0) {
+        g_metrics.injections_ok++;
+    } else if (atomic_load(&g_abort_requested)) {
+        g_metrics.injections_aborted++;
+    } else {
+        g_metrics.injections_failed++;
+    }
+    pthread_mutex_unlock(&g_metrics_mutex);
 
     if (ret == 0) {
         printf("--- Injection finished successfully. ---\n");
+    } else if (atomic_load(&g_abort_requested)) {
+        printf("--- Injection aborted after %zu of %zu keys. ---\n", offset, total_keys);
     } else {
         printf("--- Injection failed. ---\n");
     }
@@ -238,68 +1128,326 @@ void int_handler(int dummy) {
     keep_running = 0;
 }
 
-int main() {
-    pthread_t web_server_thread;
-    struct pollfd pfd;
+// monotonic milliseconds, used for debouncing without sleeping.
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// --- Trigger Inputs ---
+// every trigger is a descriptor in the main loop's epoll set, bound to a payload slot.
+// the loop only queues injections, so a press is handled at once whatever is typing.
+enum TriggerKind {
+    TRIGGER_GPIO,
+    TRIGGER_TIMER,
+    TRIGGER_HTTP,
+};
+
+struct TriggerInput {
+    enum TriggerKind kind;
+    int fd;
+    int arg;                 // GPIO pin, or timer interval in seconds
+    int slot;                // payload slot it fires, HTTP triggers name theirs in the URL
+    int debounce_ms;
+    long long last_fire_ms;  // per-input debounce state
+};
+
+static struct TriggerInput g_inputs[MAX_TRIGGER_INPUTS];
+static int g_ninputs = 0;
+
+// the web server hands HTTP triggers to the main loop through an eventfd.
+static int g_http_trigger_fd = -1;
+static atomic_uint g_http_pending = 0; // bit per slot
+static atomic_llong g_http_trigger_ns[MAX_PAYLOAD_SLOTS];
+
+int http_trigger(int slot) {
+    uint64_t one = 1;
+
+    if (g_http_trigger_fd < 0) {
+        return -1;
+    }
+    atomic_store(&g_http_trigger_ns[slot], now_ns());
+    atomic_fetch_or(&g_http_pending, 1u << slot);
+    return write(g_http_trigger_fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
+
+static int add_input(enum TriggerKind kind, int arg, int slot) {
+    if (g_ninputs == MAX_TRIGGER_INPUTS) {
+        fprintf(stderr, "Too many trigger inputs, at most %d.\n", MAX_TRIGGER_INPUTS);
+        return -1;
+    }
+    g_inputs[g_ninputs++] = (struct TriggerInput){ kind, -1, arg, slot, 0, 0 };
+    return 0;
+}
+
+// "21" or "21:3", a pin or interval optionally followed by the payload slot it fires.
+static int parse_input_spec(const char *spec, int *arg, int *slot) {
+    char *end;
+
+    *arg = (int)strtol(spec, &end, 10);
+    *slot = 0;
+    if (end == spec) {
+        return -1;
+    }
+    if (*end == ':') {
+        const char *slot_text = end + 1;
+        *slot = (int)strtol(slot_text, &end, 10);
+        if (end == slot_text) {
+            return -1;
+        }
+    }
+    return (*end == '\0' && *slot >= 0 && *slot < MAX_PAYLOAD_SLOTS) ? 0 : -1;
+}
+
+static int open_input(struct TriggerInput *input) {
     char gpio_path[64];
     char val;
 
+    switch (input->kind) {
+    case TRIGGER_GPIO:
+        // general GPIO operations. If we cannot access the GPIO, fail.
+        if (initialize_gpio(input->arg) != 0) {
+            fprintf(stderr, "Failed to initialize GPIO %d.\n", input->arg);
+            return -1;
+        }
+        sprintf(gpio_path, "/sys/class/gpio/gpio%d/value", input->arg);
+        input->fd = open(gpio_path, O_RDONLY | O_CLOEXEC);
+        if (input->fd < 0) {
+            perror("Failed to open GPIO value file");
+            cleanup_gpio(input->arg);
+            return -1;
+        }
+        // read to clear the initial state before polling
+        read(input->fd, &val, 1);
+        input->debounce_ms = DEBOUNCE_DELAY_MS;
+        return 0;
+
+    case TRIGGER_TIMER: {
+        struct itimerspec period = {
+            .it_interval = { .tv_sec = input->arg },
+            .it_value = { .tv_sec = input->arg },
+        };
+        input->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (input->fd < 0 || timerfd_settime(input->fd, 0, &period, NULL) != 0) {
+            perror("Failed to set up timed trigger");
+            return -1;
+        }
+        return 0;
+    }
+
+    case TRIGGER_HTTP:
+        input->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (input->fd < 0) {
+            perror("Failed to set up HTTP trigger");
+            return -1;
+        }
+        g_http_trigger_fd = input->fd;
+        return 0;
+    }
+    return -1;
+}
+
+// leave every input the way we found it, call once the web server is gone.
+static void close_inputs(void) {
+    g_http_trigger_fd = -1;
+    for (int i = 0; i < g_ninputs; i++) {
+        if (g_inputs[i].fd < 0) {
+            continue;
+        }
+        close(g_inputs[i].fd);
+        g_inputs[i].fd = -1;
+        if (g_inputs[i].kind == TRIGGER_GPIO) {
+            cleanup_gpio(g_inputs[i].arg);
+        }
+    }
+}
+
+static void trigger_fired(int index, int slot, long long trigger_ns) {
+    struct TriggerInput *input = &g_inputs[index];
+
+    // presses inside the debounce window are contact bounce, ignore them.
+    if (input->debounce_ms > 0 && now_ms() - input->last_fire_ms < input->debounce_ms) {
+        return;
+    }
+    input->last_fire_ms = now_ms();
+
+    // a button pressed while its own injection types is the stop button. timers and HTTP
+    // triggers never stop anything, /abort is there for that.
+    request_injection(index, slot, trigger_ns, input->kind == TRIGGER_GPIO);
+}
+
+static void handle_input(int index) {
+    struct TriggerInput *input = &g_inputs[index];
+    uint64_t count;
+    char val;
+
+    switch (input->kind) {
+    case TRIGGER_GPIO:
+        lseek(input->fd, 0, SEEK_SET);
+        // when the signal is low, it means the button was pressed.
+        // if val is '1', it's a release event, so we do nothing.
+        if (read(input->fd, &val, 1) == 1 && val == '0') {
+            trigger_fired(index, input->slot, now_ns());
+        }
+        break;
+
+    case TRIGGER_TIMER:
+        // a late wakeup that covers several periods still fires once.
+        if (read(input->fd, &count, sizeof(count)) == sizeof(count)) {
+            trigger_fired(index, input->slot, now_ns());
+        }
+        break;
+
+    case TRIGGER_HTTP:
+        if (read(input->fd, &count, sizeof(count)) == sizeof(count)) {
+            unsigned int pending = atomic_exchange(&g_http_pending, 0);
+            for (int slot = 0; slot < MAX_PAYLOAD_SLOTS; slot++) {
+                if (pending & (1u << slot)) {
+                    trigger_fired(index, slot, atomic_load(&g_http_trigger_ns[slot]));
+                }
+            }
+        }
+        break;
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-p port] [-d device] [-g gpio_pin[:slot]]... [-t seconds[:slot]]...\n"
+                    "          [-r priority] [-a cpu] [-m]\n", prog);
+    fprintf(stderr, "  -p port              HTTP port (default %d)\n", PORT);
+    fprintf(stderr, "  -d device            injector device node (default %s)\n", KERNEL_DEVICE_PATH);
+    fprintf(stderr, "  -g gpio_pin[:slot]   button firing a payload slot (default %d:0), -1 for no GPIO\n", GPIO_PIN);
+    fprintf(stderr, "  -t seconds[:slot]    fire a payload slot every so many seconds\n");
+    fprintf(stderr, "  -r priority          run the injection thread SCHED_FIFO at this priority\n");
+    fprintf(stderr, "  -a cpu               pin the injection thread to a CPU\n");
+    fprintf(stderr, "  -m                   lock the daemon's memory\n");
+    fprintf(stderr, "Payload slots are 0-%d. POST / stages slot 0, typed once; POST /payload/N fills\n"
+                    "slot N, kept until replaced. POST /trigger/N fires slot N, POST /abort stops.\n",
+            MAX_PAYLOAD_SLOTS - 1);
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t web_server_thread;
+    pthread_t injection_thread;
+    struct epoll_event events[MAX_TRIGGER_INPUTS];
+    int gpio_default = 1;
+    int opt, arg, slot;
+
+    while ((opt = getopt(argc, argv, "p:d:g:t:r:a:mh")) != -1) {
+        switch (opt) {
+        case 'p': g_port = atoi(optarg); break;
+        case 'd': g_device_path = optarg; break;
+        case 'g':
+            // any -g replaces the default button, a negative pin just adds none.
+            gpio_default = 0;
+            if (parse_input_spec(optarg, &arg, &slot) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            if (arg >= 0 && add_input(TRIGGER_GPIO, arg, slot) != 0) {
+                return 1;
+            }
+            break;
+        case 't':
+            if (parse_input_spec(optarg, &arg, &slot) != 0 || arg <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            if (add_input(TRIGGER_TIMER, arg, slot) != 0) {
+                return 1;
+            }
+            break;
+        case 'r': g_rt_priority = atoi(optarg); break;
+        case 'a': g_worker_cpu = atoi(optarg); break;
+        case 'm': g_lock_memory = 1; break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if ((gpio_default && add_input(TRIGGER_GPIO, GPIO_PIN, 0) != 0) || add_input(TRIGGER_HTTP, 0, 0) != 0) {
+        return 1;
+    }
+
     signal(SIGINT, int_handler);
     signal(SIGTERM, int_handler);
 
     printf("--- C Injector Daemon Initializing ---\n");
 
-    // general GPIO operations. If we cannot access the GPIO, return immediately.
-    if (initialize_gpio(GPIO_PIN) != 0) {
-        fprintf(stderr, "Failed to initialize GPIO. Exiting.\n");
-        return 1;
+    if (g_lock_memory) {
+        // MCL_ONFAULT locks pages as they are touched, so every web server thread stack isn't
+        // populated up front. staged payloads are touched when translated, long before a trigger.
+        int flags = MCL_CURRENT | MCL_FUTURE;
+#ifdef MCL_ONFAULT
+        flags |= MCL_ONFAULT;
+#endif
+        if (mlockall(flags) != 0) {
+            perror("mlockall failed, continuing unlocked");
+        }
     }
 
-    sprintf(gpio_path, "/sys/class/gpio/gpio%d/value", GPIO_PIN);
-    pfd.fd = open(gpio_path, O_RDONLY);
-    if (pfd.fd < 0) {
-        perror("Failed to open GPIO value file");
-        cleanup_gpio(GPIO_PIN);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("Failed to create epoll instance");
         return 1;
     }
-    pfd.events = POLLPRI | POLLERR;
+    for (int i = 0; i < g_ninputs; i++) {
+        struct epoll_event ev = {
+            .events = g_inputs[i].kind == TRIGGER_GPIO ? (EPOLLPRI | EPOLLERR) : EPOLLIN,
+            .data.u32 = (uint32_t)i,
+        };
+        if (open_input(&g_inputs[i]) != 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, g_inputs[i].fd, &ev) != 0) {
+            fprintf(stderr, "Failed to set up trigger inputs. Exiting.\n");
+            close_inputs();
+            close(epfd);
+            return 1;
+        }
+    }
 
     if (pthread_create(&web_server_thread, NULL, web_server_thread_func, NULL) != 0) {
         fprintf(stderr, "Failed to create web server thread.\n");
-        close(pfd.fd);
-        cleanup_gpio(GPIO_PIN);
+        close_inputs();
+        close(epfd);
+        return 1;
+    }
+
+    if (pthread_create(&injection_thread, NULL, injection_thread_func, NULL) != 0) {
+        fprintf(stderr, "Failed to create injection thread.\n");
+        keep_running = 0;
+        pthread_join(web_server_thread, NULL);
+        close_inputs();
+        close(epfd);
         return 1;
     }
 
-    printf("--- System Ready. Waiting for GPIO trigger on pin %d. Press Ctrl+C to exit. ---\n", GPIO_PIN);
+    // open the device now so the first trigger finds it ready.
+    device_refresh();
+
+    for (int i = 0; i < g_ninputs; i++) {
+        if (g_inputs[i].kind == TRIGGER_GPIO) {
+            printf("Trigger: GPIO %d fires slot %d.\n", g_inputs[i].arg, g_inputs[i].slot);
+        } else if (g_inputs[i].kind == TRIGGER_TIMER) {
+            printf("Trigger: every %d s fires slot %d.\n", g_inputs[i].arg, g_inputs[i].slot);
+        }
+    }
+    printf("--- System Ready. Waiting for triggers. Press Ctrl+C to exit. ---\n");
 
     while (keep_running) {
-        // read to clear the initial state before polling
-        lseek(pfd.fd, 0, SEEK_SET);
-        read(pfd.fd, &val, 1);
+        // block until a trigger fires, or a signal interrupts the wait.
+        int n = epoll_wait(epfd, events, MAX_TRIGGER_INPUTS, -1);
 
-        //block until a GPIO event (interrupt) occurs
-        int poll_ret = poll(&pfd, 1, -1);
-        
         if (!keep_running) break;
 
-        if (poll_ret > 0) {
-            if (pfd.revents & (POLLPRI | POLLERR)) {
-                lseek(pfd.fd, 0, SEEK_SET);
-                read(pfd.fd, &val, 1);
-
-                // when the signal is low, it means the button was pressed, execute.
-                if (val == '0') {
-                    perform_injection();
-                    
-                    printf("\n--- Injection complete. Debouncing for %dms... ---\n", DEBOUNCE_DELAY_MS);
-                    // button debouncing delay
-                    usleep(DEBOUNCE_DELAY_MS * 1000);
-                    
-                    printf("--- Re-arming. Waiting for next GPIO trigger... ---\n");
-                }
-                // if val is '1', it's a release event, so we do nothing.
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            perror("epoll_wait failed");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            handle_input((int)events[i].data.u32);
         }
     }
     
@@ -308,10 +1456,28 @@ int main() {
     
     pthread_cancel(web_server_thread);
     pthread_join(web_server_thread, NULL);
+
+    // stop any injection in flight, then wake the injection thread so it sees keep_running.
+    // decided under the lock, a request dequeued a moment ago already counts as in flight.
+    pthread_mutex_lock(&g_inject_mutex);
+    g_inject_queued = 0;
+    if (g_inject_active.input >= 0) {
+        abort_injection();
+    }
+    pthread_cond_signal(&g_inject_cond);
+    pthread_mutex_unlock(&g_inject_mutex);
+    pthread_join(injection_thread, NULL);
     
-    close(pfd.fd);
-    cleanup_gpio(GPIO_PIN);
-    free(g_staged_payload);
+    close_inputs();
+    close(epfd);
+    for (int i = 0; i < MAX_PAYLOAD_SLOTS; i++) {
+        release_payload(g_payloads[i]);
+        g_payloads[i] = NULL;
+    }
+
+    pthread_mutex_lock(&g_device_mutex);
+    device_close_locked();
+    pthread_mutex_unlock(&g_device_mutex);
     
     printf("Shutdown complete.\n");
     return 0;